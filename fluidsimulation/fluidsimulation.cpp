@@ -1,318 +1,535 @@
-#include "fluidsimulation.h"
-
-static data_type u[SIZE][SIZE];
-static data_type v[SIZE][SIZE];
-static data_type u_prev[SIZE][SIZE];
-static data_type v_prev[SIZE][SIZE];
-static data_type dens[SIZE][SIZE];
-static data_type dens_prev[SIZE][SIZE];
-static data_type p[SIZE][SIZE];
-static data_type div_[SIZE][SIZE];
-
-void swap(data_type a[SIZE][SIZE], data_type b[SIZE][SIZE])
+#include "fluidsimulation_solver.h"
+
+#ifndef __SYNTHESIS__
+#include <cstdio>
+#endif
+
+static fluid_state<data_type> state;
+
+// Reads num_sources records of SOURCE_RECORD_BEATS beats each
+static void read_sources(hls::stream<packet> &source_stream, fluid_source<data_type> sources[MAX_SOURCES], int num_sources)
 {
 #pragma HLS INLINE off
-    for (int y = 0; y < SIZE; y++)
+read_sources_loop:
+    for (int k = 0; k < num_sources; k++)
     {
-        for (int x = 0; x < SIZE; x++)
-        {
-            data_type temp = a[y][x];
-            a[y][x] = b[y][x];
-            b[y][x] = temp;
-        }
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SOURCES
+#pragma HLS PIPELINE II = SOURCE_RECORD_BEATS
+        packet word = source_stream.read();
+        sources[k].x = word.data & 0xffff;
+        sources[k].y = (word.data >> 16) & 0xffff;
+        scalar_from_bits(source_stream.read().data, sources[k].dens);
+        scalar_from_bits(source_stream.read().data, sources[k].u);
+        scalar_from_bits(source_stream.read().data, sources[k].v);
+        scalar_from_bits(source_stream.read().data, sources[k].temp);
     }
 }
 
-void set_bnd(int b, data_type x[SIZE][SIZE])
+// Obstacle mask row as it is streamed in, whole beats
+typedef ap_uint<32 * OBSTACLE_ROW_BEATS(MAX_N)> obstacle_row_type;
+
+// Reads an obstacle mask of OBSTACLE_ROW_BEATS(n) beats per row
+static void read_obstacles(hls::stream<packet> &source_stream, int n)
 {
 #pragma HLS INLINE off
-set_bnd_loop:
-    for (int i = 1; i <= N; i++)
+read_obstacles_i_loop:
+    for (int i = 0; i < n + 2; i++)
     {
-#pragma HLS PIPELINE off
-        x[0][i] = (b == 1) ? data_type(-x[1][i]) : data_type(x[1][i]);
-        x[N + 1][i] = (b == 1) ? data_type(-x[N][i]) : data_type(x[N][i]);
-        x[i][0] = (b == 2) ? data_type(-x[i][1]) : data_type(x[i][1]);
-        x[i][N + 1] = (b == 2) ? data_type(-x[i][N]) : data_type(x[i][N]);
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+        obstacle_row_type row = 0;
+    read_obstacles_beat_loop:
+        for (int beat = 0; beat < OBSTACLE_ROW_BEATS(n); beat++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = OBSTACLE_ROW_BEATS(MAX_N)
+#pragma HLS PIPELINE II = 1
+            row.range(32 * beat + 31, 32 * beat) = source_stream.read().data;
+        }
+        state.obstacles.solid[i] = row;
     }
-
-    x[0][0] = data_type(0.5) * (x[1][0] + x[0][1]);
-    x[0][N + 1] = data_type(0.5) * (x[1][N + 1] + x[0][N]);
-    x[N + 1][0] = data_type(0.5) * (x[N][0] + x[N + 1][1]);
-    x[N + 1][N + 1] = data_type(0.5) * (x[N][N + 1] + x[N + 1][N]);
+    obstacle_build(state.obstacles, n);
 }
 
-void add_source(data_type x[SIZE][SIZE], data_type s[SIZE][SIZE], float dt)
+static data_type output_value(int field, int i, int j)
 {
-#pragma HLS INLINE off
-add_source_i_loop:
-    for (int i = 0; i < SIZE; i++)
+#pragma HLS INLINE
+    switch (field)
     {
-#pragma HLS PIPELINE off
-    add_source_j_loop:
-        for (int j = 0; j < SIZE; j++)
-        {
-#pragma HLS PIPELINE off
-            x[i][j] += data_type(dt) * s[i][j];
-        }
+    case 0:
+        return state.dens[state.dens_bank][i][j];
+    case 1:
+        return state.u[state.vel_bank][i][j];
+    case 2:
+        return state.v[state.vel_bank][i][j];
+    case 3:
+        return state.p[i][j];
+    case 4:
+        return state.div_[i][j];
+    default:
+        return state.temp[state.temp_bank][i][j];
     }
 }
 
-void diffuse(int b, data_type x[SIZE][SIZE], data_type x0[SIZE][SIZE], float diff, float dt)
+// Streams the fields selected in mask in a single pass over the grid. Pressure
+// and divergence are the ones of the last projection of the frame, solid
+// cells stream as zero. Returns the beats it wrote.
+static int write_output(hls::stream<packet> &output_stream, int n, int mask, int format, int layout)
 {
 #pragma HLS INLINE off
-    float a = dt * diff * N * N;
-diffuse_k_loop:
-    for (int k = 0; k < 20; k++)
+    // Selected fields in mask bit order
+    int order[OUTPUT_FIELDS];
+    int fields = 0;
+select_loop:
+    for (int f = 0; f < OUTPUT_FIELDS; f++)
     {
-#pragma HLS PIPELINE off
-#pragma HLS LOOP_FLATTEN off
-    diffuse_i_loop:
-        for (int i = 1; i <= N; i++)
+        if ((mask >> f) & 1)
+            order[fields++] = f;
+    }
+
+    int values = fields * (n + 2) * (n + 2);
+    int beats = (format == OUTPUT_PACKED16) ? (values + 1) / 2 : values;
+    bool planar = (layout == OUTPUT_PLANAR);
+
+    // Position of the next value, the slot indexes order[]
+    int slot = 0, i = 0, j = 0;
+    int beat = 0;
+    ap_uint<32> word = 0;
+
+write_loop:
+    for (int k = 0; k < values; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = OUTPUT_FIELDS * MAX_SIZE * MAX_SIZE
+#pragma HLS PIPELINE II = 1
+        bool solid = state.obstacles.solid[i][j] && i >= 1 && i <= n && j >= 1 && j <= n;
+        data_type value = solid ? data_type(0) : output_value(order[slot], i, j);
+        packet output;
+        bool ready = true;
+
+        if (format == OUTPUT_PACKED16)
         {
-#pragma HLS PIPELINE off
-#pragma HLS LOOP_FLATTEN off
-        diffuse_j_loop:
-            for (int j = 1; j <= N; j++)
-            {
-#pragma HLS PIPELINE off
-#pragma HLS LOOP_FLATTEN off
-                x[i][j] = (x0[i][j] + data_type(a) * (x[i - 1][j] + x[i + 1][j] + x[i][j - 1] + x[i][j + 1])) / data_type(1 + 4 * a);
-            }
+            output_packed_type packed = value;
+            if ((k & 1) == 0)
+                word.range(15, 0) = packed.range(15, 0);
+            else
+                word.range(31, 16) = packed.range(15, 0);
+            // An odd count leaves the last beat with only its low half
+            ready = (k & 1) == 1 || k == values - 1;
+            output.data = word;
+        }
+        else
+        {
+            output.data = value * data_type(16.0);
+        }
+
+        if (ready)
+        {
+            output.keep = -1;
+            output.strb = -1;
+            output.last = (beat == beats - 1);
+            output_stream.write(output);
+            beat++;
+            word = 0;
+        }
+
+        // Interleaved steps through the fields of a cell first, planar
+        // through a whole grid
+        if (!planar && slot < fields - 1)
+        {
+            slot++;
+        }
+        else if (j < n + 1)
+        {
+            if (!planar)
+                slot = 0;
+            j++;
+        }
+        else if (i < n + 1)
+        {
+            if (!planar)
+                slot = 0;
+            j = 0;
+            i++;
+        }
+        else
+        {
+            slot++;
+            i = 0;
+            j = 0;
         }
-        set_bnd(b, x);
     }
+    return beat;
 }
 
-void advect(int b, data_type d[SIZE][SIZE], data_type d0[SIZE][SIZE],
-            data_type u[SIZE][SIZE], data_type v[SIZE][SIZE], float dt)
+// Streams the density as an OUTPUT_DELTA8 frame. Every cell adds at most a
+// finished run and an escaped difference, four bytes, so with at most three
+// bytes left over from before there is never more than one beat to send.
+// Returns the beats it wrote.
+static int write_delta8(hls::stream<packet> &output_stream, int n)
 {
 #pragma HLS INLINE off
-    float dt0 = dt * N;
-advect_i_loop:
-    for (int i = 1; i <= N; i++)
+    static ap_uint<8> previous[MAX_SIZE][MAX_SIZE];
+    static int previous_n = 0;
+    static int frames_since_keyframe = 0;
+
+    bool keyframe = n != previous_n || frames_since_keyframe >= DELTA8_KEYFRAME_INTERVAL - 1;
+    frames_since_keyframe = keyframe ? 0 : frames_since_keyframe + 1;
+    previous_n = n;
+
+    packet output;
+    output.keep = -1;
+    output.strb = -1;
+    output.last = false;
+    output.data = (n + 2) | (int(keyframe) << 16);
+    output_stream.write(output);
+    int beats = 1;
+
+    int cells = (n + 2) * (n + 2);
+    ap_uint<64> bytes = 0; // Pending bytes, the oldest one in the low byte
+    int count = 0;
+    int run = 0;
+    int i = 0, j = 0;
+
+delta8_loop:
+    for (int k = 0; k < cells; k++)
     {
-#pragma HLS PIPELINE off
-    advect_j_loop:
-        for (int j = 1; j <= N; j++)
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE * MAX_SIZE
+#pragma HLS PIPELINE II = 1
+        bool solid = state.obstacles.solid[i][j] && i >= 1 && i <= n && j >= 1 && j <= n;
+        data_type scaled = state.dens[state.dens_bank][i][j] * data_type(DELTA8_SCALE);
+        ap_uint<8> q = (solid || scaled < 0) ? 0 : (scaled > 255) ? 255 : int(scaled);
+        ap_uint<8> d = keyframe ? q : ap_uint<8>(q - previous[i][j]);
+        previous[i][j] = q;
+
+        // Up to two escaped pairs: the run that ends here and the difference
+        ap_uint<32> code = 0;
+        int code_bytes = 0;
+        if (d == 0)
+            run++;
+        if (run > 0 && (d != 0 || run == 255 || k == cells - 1))
         {
-#pragma HLS PIPELINE off
-            float x = i - data_type(dt0) * u[i][j];
-            float y = j - data_type(dt0) * v[i][j];
-
-            if (x < 0.5)
-                x = 0.5;
-            if (x > N + 0.5)
-                x = N + 0.5;
-            if (y < 0.5)
-                y = 0.5;
-            if (y > N + 0.5)
-                y = N + 0.5;
-
-            int i0 = (int)x;
-            int i1 = i0 + 1;
-            int j0 = (int)y;
-            int j1 = j0 + 1;
-
-            float s1 = x - i0;
-            float s0 = 1 - s1;
-            float t1 = y - j0;
-            float t0 = 1 - t1;
-
-            // clamp indices
-            if (i0 < 0)
-                i0 = 0;
-            if (i0 > N + 1)
-                i0 = N + 1;
-            if (i1 < 0)
-                i1 = 0;
-            if (i1 > N + 1)
-                i1 = N + 1;
-            if (j0 < 0)
-                j0 = 0;
-            if (j0 > N + 1)
-                j0 = N + 1;
-            if (j1 < 0)
-                j1 = 0;
-            if (j1 > N + 1)
-                j1 = N + 1;
-
-            d[i][j] = data_type(s0) * (data_type(t0) * d0[i0][j0] + data_type(t1) * d0[i0][j1]) +
-                      data_type(s1) * (data_type(t0) * d0[i1][j0] + data_type(t1) * d0[i1][j1]);
+            code = DELTA8_ESCAPE | (run << 8);
+            code_bytes = 2;
+            run = 0;
+        }
+        if (d != 0)
+        {
+            ap_uint<16> literal = (d == DELTA8_ESCAPE) ? ap_uint<16>(DELTA8_ESCAPE) : ap_uint<16>(d);
+            code |= ap_uint<32>(literal) << (8 * code_bytes);
+            code_bytes += (d == DELTA8_ESCAPE) ? 2 : 1;
+        }
+
+        bytes |= ap_uint<64>(code) << (8 * count);
+        count += code_bytes;
+        if (count >= 4)
+        {
+            output.data = bytes.range(31, 0);
+            output_stream.write(output);
+            beats++;
+            bytes >>= 32;
+            count -= 4;
+        }
+
+        if (j < n + 1)
+        {
+            j++;
+        }
+        else
+        {
+            j = 0;
+            i++;
         }
     }
-    set_bnd(b, d);
+
+    // The rest, possibly only padding, goes out with TLAST
+    output.data = bytes.range(31, 0);
+    output.last = true;
+    output_stream.write(output);
+    return beats + 1;
 }
 
-void project(data_type u[SIZE][SIZE], data_type v[SIZE][SIZE],
-             data_type p[SIZE][SIZE], data_type div_[SIZE][SIZE])
+// Writes the state of an n x n grid to checkpoint in one burst per plane.
+// Returns -1 if nothing was simulated yet.
+static int save_state(int *checkpoint, int n)
 {
 #pragma HLS INLINE off
-    project_i_loop:
-    for (int i = 1; i <= N; i++)
-    {
-#pragma HLS UNROLL off
-#pragma HLS PIPELINE off
-        project_j_loop:
-        for (int j = 1; j <= N; j++)
-        {
-#pragma HLS UNROLL off
-#pragma HLS PIPELINE off
-            div_[i][j] = data_type(-0.5) * ((u[i + 1][j] - u[i - 1][j]) + (v[i][j + 1] - v[i][j - 1])) / N;
-            p[i][j] = 0;
-        }
-    }
-    set_bnd(0, div_);
-    set_bnd(0, p);
+    if (n == 0)
+        return -1;
+
+    checkpoint[0] = CHECKPOINT_MAGIC;
+    checkpoint[1] = n;
+    checkpoint[2] = int(state.vel_bank) | (int(state.dens_bank) << 1) | (int(state.temp_bank) << 2);
+    checkpoint[3] = scalar_type_tag(data_type());
 
-    project_k_loop:
-    for (int k = 0; k < 50; k++)
+    int plane_size = (n + 2) * (n + 2);
+save_plane_loop:
+    for (int plane = 0; plane < CHECKPOINT_PLANES; plane++)
     {
-#pragma HLS PIPELINE off
-#pragma HLS UNROLL off
-        project_ki_loop:
-        for (int i = 1; i <= N; i++)
+        int *out = checkpoint + CHECKPOINT_HEADER + plane * plane_size;
+    save_i_loop:
+        for (int i = 0; i < n + 2; i++)
         {
-#pragma HLS PIPELINE off
-#pragma HLS UNROLL off
-            project_kj_loop:
-            for (int j = 1; j <= N; j++)
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+        save_j_loop:
+            for (int j = 0; j < n + 2; j++)
             {
-#pragma HLS PIPELINE off
-#pragma HLS UNROLL off
-                p[i][j] = (div_[i][j] + p[i - 1][j] + p[i + 1][j] + p[i][j - 1] + p[i][j + 1]) / data_type(4.0);
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+#pragma HLS PIPELINE II = 1
+                data_type value;
+                switch (plane)
+                {
+                case 0: value = state.u[0][i][j]; break;
+                case 1: value = state.u[1][i][j]; break;
+                case 2: value = state.v[0][i][j]; break;
+                case 3: value = state.v[1][i][j]; break;
+                case 4: value = state.dens[0][i][j]; break;
+                case 5: value = state.dens[1][i][j]; break;
+                case 6: value = state.p[i][j]; break;
+                case 7: value = state.div_[i][j]; break;
+                case 8: value = state.temp[0][i][j]; break;
+                default: value = state.temp[1][i][j]; break;
+                }
+                out[i * (n + 2) + j] = scalar_to_bits(value);
             }
         }
-        set_bnd(0, p);
     }
 
-    project_i2_loop:
-    for (int i = 1; i <= N; i++)
+    int *mask = checkpoint + CHECKPOINT_HEADER + CHECKPOINT_PLANES * plane_size;
+save_obstacles_i_loop:
+    for (int i = 0; i < n + 2; i++)
     {
-#pragma HLS PIPELINE off
-#pragma HLS UNROLL off
-        project_j2_loop:
-        for (int j = 1; j <= N; j++)
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+        obstacle_row_type row = state.obstacles.solid[i];
+    save_obstacles_beat_loop:
+        for (int beat = 0; beat < OBSTACLE_ROW_BEATS(n); beat++)
         {
-#pragma HLS PIPELINE off
-#pragma HLS UNROLL off
-            u[i][j] -= data_type(0.5) * N * (p[i + 1][j] - p[i - 1][j]);
-            v[i][j] -= data_type(0.5) * N * (p[i][j + 1] - p[i][j - 1]);
+#pragma HLS LOOP_TRIPCOUNT max = OBSTACLE_ROW_BEATS(MAX_N)
+#pragma HLS PIPELINE II = 1
+            mask[i * OBSTACLE_ROW_BEATS(n) + beat] = row.range(32 * beat + 31, 32 * beat);
         }
     }
-    set_bnd(1, u);
-    set_bnd(2, v);
+    return 0;
 }
 
-void vel_step(data_type u[SIZE][SIZE], data_type v[SIZE][SIZE],
-              data_type u0[SIZE][SIZE], data_type v0[SIZE][SIZE],
-              float visc, float dt)
+// Restores the state from checkpoint. Returns its grid size, or -1 if the
+// checkpoint is not one of ours.
+static int load_state(int *checkpoint)
 {
 #pragma HLS INLINE off
-    add_source(u, u0, dt);
-    add_source(v, v0, dt);
-
-    swap(u, u0);
-    swap(v, v0);
+    int n = checkpoint[1];
+    if (checkpoint[0] != CHECKPOINT_MAGIC || checkpoint[3] != scalar_type_tag(data_type()) || n < 2 || n > MAX_N)
+        return -1;
 
-    diffuse(1, u, u0, visc, dt);
-    diffuse(2, v, v0, visc, dt);
-    project(u, v, p, div_);
+    state.vel_bank = checkpoint[2] & 1;
+    state.dens_bank = (checkpoint[2] >> 1) & 1;
+    state.temp_bank = (checkpoint[2] >> 2) & 1;
 
-    swap(u, u0);
-    swap(v, v0);
+    int plane_size = (n + 2) * (n + 2);
+load_plane_loop:
+    for (int plane = 0; plane < CHECKPOINT_PLANES; plane++)
+    {
+        int *in = checkpoint + CHECKPOINT_HEADER + plane * plane_size;
+    load_i_loop:
+        for (int i = 0; i < n + 2; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+        load_j_loop:
+            for (int j = 0; j < n + 2; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+#pragma HLS PIPELINE II = 1
+                data_type value;
+                scalar_from_bits(in[i * (n + 2) + j], value);
+                switch (plane)
+                {
+                case 0: state.u[0][i][j] = value; break;
+                case 1: state.u[1][i][j] = value; break;
+                case 2: state.v[0][i][j] = value; break;
+                case 3: state.v[1][i][j] = value; break;
+                case 4: state.dens[0][i][j] = value; break;
+                case 5: state.dens[1][i][j] = value; break;
+                case 6: state.p[i][j] = value; break;
+                case 7: state.div_[i][j] = value; break;
+                case 8: state.temp[0][i][j] = value; break;
+                default: state.temp[1][i][j] = value; break;
+                }
+            }
+        }
+    }
 
-    advect(1, u, u0, u0, v0, dt);
-    advect(2, v, v0, u0, v0, dt);
-    project(u, v, p, div_);
+    int *mask = checkpoint + CHECKPOINT_HEADER + CHECKPOINT_PLANES * plane_size;
+load_obstacles_i_loop:
+    for (int i = 0; i < n + 2; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+        obstacle_row_type row = 0;
+    load_obstacles_beat_loop:
+        for (int beat = 0; beat < OBSTACLE_ROW_BEATS(n); beat++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = OBSTACLE_ROW_BEATS(MAX_N)
+#pragma HLS PIPELINE II = 1
+            row.range(32 * beat + 31, 32 * beat) = mask[i * OBSTACLE_ROW_BEATS(n) + beat];
+        }
+        state.obstacles.solid[i] = row;
+    }
+    obstacle_build(state.obstacles, n);
+    return n;
 }
 
-void dens_step(data_type x[SIZE][SIZE], data_type x0[SIZE][SIZE],
-               data_type u[SIZE][SIZE], data_type v[SIZE][SIZE],
-               float diff, float dt)
+// The compute function replicates the behavior of the Python compute function.
+// The grid has n x n cells, 2 <= n <= MAX_N, and the state is cleared whenever
+// n changes. Each call simulates num_frames frames, reading num_sources source
+// records from source_stream for every one of them, and streams out every
+// frame_stride-th frame. A tolerance > 0 lets the solvers stop early, the
+// sweeps they ran are summed up in iterations and profile gets the cycles of
+// every stage in this call, read from cycle_counter, see stage_profile. They
+// are 64-bit, a long num_frames batch passes 2^31 cycles in about 21 s at
+// 100 MHz.
+// output_mask selects the fields
+// streamed out (OUTPUT_DENSITY | OUTPUT_U | ...) in the given word format and
+// layout, each streamed frame ends with TLAST. OUTPUT_DELTA8 only takes
+// OUTPUT_DENSITY.
+//
+// MODE_SAVE and MODE_LOAD instead dump the state to or restore it from the
+// checkpoint buffer in DDR, see CHECKPOINT_WORDS for its layout. A loaded
+// state keeps its own grid size, the n argument is ignored. MODE_OBSTACLES
+// reads the obstacle mask of an n x n grid from source_stream, it stays in
+// place until the next mask or the next change of n.
+int fluidsimulation_compute(int mode, int *checkpoint,
+                            hls::stream<packet> &source_stream, hls::stream<packet> &output_stream,
+                            int num_sources, int num_frames, int frame_stride, int n, float tolerance, int &iterations,
+                            long long profile[STAGE_COUNT], const volatile long long *cycle_counter, int output_mask,
+                            int output_format, int output_layout)
 {
-#pragma HLS INLINE off
-    add_source(x, x0, dt);
-
-    swap(x, x0);
+#pragma HLS INTERFACE mode = s_axilite port = return
+#pragma HLS INTERFACE mode = s_axilite port = mode
+#pragma HLS INTERFACE mode = m_axi port = checkpoint offset = slave bundle = gmem depth = CHECKPOINT_WORDS(MAX_N) max_read_burst_length = 256 max_write_burst_length = 256
+#pragma HLS INTERFACE mode = s_axilite port = checkpoint
+#pragma HLS INTERFACE mode = s_axilite port = num_sources
+#pragma HLS INTERFACE mode = s_axilite port = num_frames
+#pragma HLS INTERFACE mode = s_axilite port = frame_stride
+#pragma HLS INTERFACE mode = s_axilite port = n
+#pragma HLS INTERFACE mode = s_axilite port = tolerance
+#pragma HLS INTERFACE mode = s_axilite port = iterations
+#pragma HLS INTERFACE mode = s_axilite port = profile
+#pragma HLS INTERFACE mode = ap_none port = cycle_counter
+#pragma HLS INTERFACE mode = s_axilite port = output_mask
+#pragma HLS INTERFACE mode = s_axilite port = output_format
+#pragma HLS INTERFACE mode = s_axilite port = output_layout
+#pragma HLS INTERFACE mode = axis port = source_stream
+#pragma HLS INTERFACE mode = axis port = output_stream
 
-    diffuse(0, x, x0, diff, dt);
+    static int current_n = 0;
+    static fluid_source<data_type> sources[MAX_SOURCES];
 
-    swap(x, x0);
+    if (mode == MODE_SAVE)
+        return save_state(checkpoint, current_n);
 
-    advect(0, x, x0, u, v, dt);
-}
+    if (mode == MODE_LOAD)
+    {
+        int loaded = load_state(checkpoint);
+        if (loaded < 0)
+            return -1;
+        current_n = loaded;
+        return 0;
+    }
 
-// The compute function replicates the behavior of the Python compute function.
-int fluidsimulation_compute(hls::stream<packet> &output_stream, int &frame)
-{
-#pragma HLS INTERFACE mode = s_axilite port = return
-#pragma HLS INTERFACE mode = s_axilite port = frame
-#pragma HLS INTERFACE mode = axis port = output_stream
+    if (n < 2 || n > MAX_N)
+        return -1;
 
-    // Clear previous sources
-    clear_i_loop:
-    for (int i = 0; i < SIZE; i++)
+    if (mode == MODE_OBSTACLES)
     {
-        clear_j_loop:
-        for (int j = 0; j < SIZE; j++)
+        if (n != current_n)
         {
-            dens_prev[i][j] = 0.0;
-            u_prev[i][j] = 0.0;
-            v_prev[i][j] = 0.0;
+            fluid_reset(state);
+            current_n = n;
         }
+        read_obstacles(source_stream, n);
+        return 0;
     }
 
-    float t = frame * DT;
-    int num_sources = 5;
+    if (num_sources < 0 || num_sources > MAX_SOURCES)
+        return -1;
+
+    if (num_frames < 1 || frame_stride < 1)
+        return -1;
 
-    sources_loop:
-    for (int s = 0; s < num_sources; s++)
+    if (output_mask <= 0 || output_mask >= (1 << OUTPUT_FIELDS))
+        return -1;
+
+    if (output_format == OUTPUT_DELTA8 && output_mask != OUTPUT_DENSITY)
+        return -1;
+
+    if (n != current_n)
     {
-        float base_angle = 2.0 * M_PI * s / num_sources;
-        float angle = base_angle + t * 0.1;
-        int radius = N / 4;
-        int cx = N / 2;
-        int cy = N / 2;
-        int x_pos = (int)(cx + radius * std::cos(angle));
-        int y_pos = (int)(cy + radius * std::sin(angle));
-        if (x_pos >= 1 && x_pos < N + 1 && y_pos >= 1 && y_pos < N + 1)
-        {
-            dens_prev[x_pos][y_pos] = 200.0;
-            u_prev[x_pos][y_pos] = 50.0 * std::cos(angle);
-            v_prev[x_pos][y_pos] = 50.0 * std::sin(angle);
-        }
+        fluid_reset(state);
+        current_n = n;
     }
 
-    vel_step(u, v, u_prev, v_prev, VISC, DT);
-    dens_step(dens, dens_prev, u, v, DIFF, DT);
+    iterations = 0;
+    profile_clear(state.profile);
+
+    int output_fields = 0;
+count_fields_loop:
+    for (int f = 0; f < OUTPUT_FIELDS; f++)
+        output_fields += (output_mask >> f) & 1;
 
-write_i_loop:
-    for (int i = 0; i < SIZE; ++i)
+frames_loop:
+    for (int f = 0; f < num_frames; f++)
     {
-#pragma HLS LOOP_TRIPCOUNT max = 100 avg = 100 min = 100
-    write_j_loop:
-        for (int j = 0; j < SIZE; ++j)
-        {
-#pragma HLS LOOP_TRIPCOUNT max = 100 avg = 100 min = 100
+#pragma HLS LOOP_TRIPCOUNT max = 1
+        int records = profile_begin(state.profile, *cycle_counter, num_sources);
+        read_sources(source_stream, sources, records);
+        int injected = inject_sources(state, sources, records, DT, n);
+        profile_end(state.profile, *cycle_counter, STAGE_SOURCES, injected);
 
-            packet output;
-            output.data = dens[i][j]*data_type(16.0);
-            output.keep = -1;
-            output.strb = -1;
-            // output.user = input_data.user;
-            // output.last = input_data.last;
-            // output.id = input_data.id;
-            // output.dest = input_data.dest;
+        iterations += fluid_advance(state, n, tolerance, *cycle_counter);
 
-            if (i == SIZE - 1 && j == SIZE - 1)
-                output.last = true;
+        if (f % frame_stride == frame_stride - 1)
+        {
+            int output_n = profile_begin(state.profile, *cycle_counter, n);
+            int beats;
+            if (output_format == OUTPUT_DELTA8)
+                beats = write_delta8(output_stream, output_n);
             else
-                output.last = false;
-
-            output_stream.write(output);
+                beats = write_output(output_stream, output_n, output_mask, output_format, output_layout);
+            profile_end(state.profile, *cycle_counter, STAGE_OUTPUT, beats);
         }
     }
 
+profile_loop:
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        profile[stage] = state.profile.cycles[stage];
+
     return 0;
-}
\ No newline at end of file
+}
+
+// Free-running counter for the cycle_counter input of fluidsimulation_compute.
+// A top of its own without block level control, synthesized on its own with
+// set_top fluidsimulation_cycle_counter: it counts from reset on, alongside
+// every stage of the kernel. Clock it with the kernel and wire count to
+// cycle_counter in the block design.
+void fluidsimulation_cycle_counter(volatile long long *count)
+{
+#pragma HLS INTERFACE mode = ap_ctrl_none port = return
+#pragma HLS INTERFACE mode = ap_none port = count
+    long long value = 0;
+cycle_counter_loop:
+    while (true)
+    {
+#pragma HLS PIPELINE II = 1
+        *count = value;
+        value++;
+    }
+}
+
+#ifndef __SYNTHESIS__
+void fluidsimulation_print_profile()
+{
+    static const char *names[STAGE_COUNT] = {"sources", "forces", "diffuse", "project", "advect", "output"};
+    long long total = 0;
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        total += state.profile.cycles[stage];
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        printf("%-8s %10.3f ms %6.1f %%\n", names[stage], 1e-6 * state.profile.cycles[stage],
+               total > 0 ? 100.0 * state.profile.cycles[stage] / total : 0.0);
+}
+#endif
\ No newline at end of file
@@ -7,15 +7,161 @@
 #include "hls_math.h"
 
 // Simulation parameters
-#define N 50          // Grid size
+#define MAX_N 100     // Largest grid size, the size itself is a runtime argument
 #define DT 0.1      // Time step
 #define DIFF 0.0    // Diffusion rate
 #define VISC 0.0001 // Viscosity
-#define SIZE (N + 2) // Array dimension including boundaries
+#define MAX_SIZE (MAX_N + 2) // Array dimension including boundaries
+
+// Linear solver used by diffuse() and project()
+#define SOLVER_GAUSS_SEIDEL 0 // In-place lexicographic sweeps
+#define SOLVER_RED_BLACK 1    // Checkerboard ordered sweeps, pipelinable at II=1
+#define SOLVER_MULTIGRID 2    // Geometric multigrid V-cycles with red-black smoothing
+#ifndef SOLVER
+#define SOLVER SOLVER_GAUSS_SEIDEL
+#endif
+
+#define DIFFUSE_ITERS 20 // Solver sweeps per diffuse()
+#define PROJECT_ITERS 50 // Solver sweeps per project()
+#define RESIDUAL_CHECK_INTERVAL 5 // Sweeps between residual checks when a tolerance is set
+
+// Multigrid, used instead of the sweep counts above
+#define MG_LEVELS 4        // Grid levels including the finest, n = 50 gives 50, 25, 13, 7
+#define MG_CYCLES 2        // V-cycles per solve
+#define MG_PRE_SMOOTH 2    // Red-black sweeps before restriction
+#define MG_POST_SMOOTH 2   // Red-black sweeps after prolongation
+#define MG_COARSE_SMOOTH 8 // Red-black sweeps on the coarsest level
+// Each coarse level keeps an error and a right hand side plane of its own
+// largest grid, at MAX_N 100 52^2, 27^2 and 15^2 words: 2 * (6 + 2 + 1) = 18
+// BRAM18 with 32-bit data_type. The residual of the finest level is a full
+// MAX_SIZE^2 plane, another 21.
+
+// Advection engine
+#define ADVECT_ENGINE_DIRECT 0 // Float backtrace, four random reads of d0 per cell
+#define ADVECT_ENGINE_WINDOW 1 // Fixed-point backtrace over a parity banked sliding row window, II=1
+#ifndef ADVECT_ENGINE
+#define ADVECT_ENGINE ADVECT_ENGINE_DIRECT
+#endif
+#define ADVECT_MAX_DISPLACEMENT 4 // Backtrace limit in cells of the window engine, longer ones are clamped
+#define ADVECT_WINDOW_ROWS (2 * ADVECT_MAX_DISPLACEMENT + 4) // Rows the window holds, even
+
+// Advection scheme. With FUSED_ADVECT_PROJECT on, the default, MacCormack
+// only applies to the density and temperature, never to the velocity.
+#define ADVECT_SEMI_LAGRANGIAN 0 // First-order backtrace
+#define ADVECT_MACCORMACK 1      // Forward and backward advect with error correction and min / max limiter
+#ifndef ADVECT_SCHEME
+#define ADVECT_SCHEME ADVECT_SEMI_LAGRANGIAN
+#endif
+#define ADVECT_PASSES ((ADVECT_SCHEME == ADVECT_MACCORMACK) ? 3 : 1) // Grid passes per advected field
+
+// Stream the velocity advection straight into the divergence pass of the
+// following projection (DATAFLOW) instead of two separate grid passes. The
+// fused path advects the velocity first-order whatever ADVECT_SCHEME says,
+// with ADVECT_SEMI_LAGRANGIAN both give the same fields bit for bit.
+#ifndef FUSED_ADVECT_PROJECT
+#define FUSED_ADVECT_PROJECT 1
+#endif
+
+// Forces added to the velocity at the start of vel_step, two II=1 passes over
+// 3x3 neighbourhoods. Vorticity confinement puts back the small-scale swirl
+// numerical dissipation smears out on coarse grids; buoyancy lifts hot cells
+// and pulls dense ones down. Up is +u, the row index i, as fluidsimulation.py
+// draws it with origin='lower'; the notebook and the testbench image put row 0
+// on top, so there the smoke rises downwards. Off by default, the Python
+// reference has neither force.
+#ifndef FLUID_FORCES
+#define FLUID_FORCES 0         // 1 adds both passes
+#endif
+#define VORTICITY_EPS 2.0      // Confinement strength
+#define BUOYANCY_ALPHA 0.01    // Downward pull per unit of density
+#define BUOYANCY_BETA 0.5      // Lift per unit of temperature above ambient
+#define AMBIENT_TEMPERATURE 0.0
+
+// Host supplied sources
+#define MAX_SOURCES 64        // Source records per call
+#define SOURCE_RECORD_BEATS 5 // Beats per record: x | y << 16, then density, u, v and temperature as raw data_type bits, see scalar_to_bits
+
+// fluidsimulation_compute modes
+#define MODE_RUN 0  // Simulate and stream frames
+#define MODE_SAVE 1 // Write the whole state to checkpoint
+#define MODE_LOAD 2 // Restore the whole state from checkpoint
+#define MODE_OBSTACLES 3 // Read a new obstacle mask from source_stream
+
+// Obstacle mask: (n + 2) rows of OBSTACLE_ROW_BEATS(n) beats, bit j % 32 of
+// beat j / 32 of row i set for a solid cell (i, j). The outer ring is the box
+// wall whatever its bits say.
+#define OBSTACLE_ROW_BEATS(n) (((n) + 2 + 31) / 32)
+
+// Checkpoint layout in 32-bit words: CHECKPOINT_MAGIC, n,
+// vel_bank | dens_bank << 1 | temp_bank << 2, the data_type tag of
+// scalar_type_tag, then the (n + 2) x (n + 2) planes u[0], u[1], v[0], v[1],
+// dens[0], dens[1], p, div_, temp[0] and temp[1] as raw data_type bits, then
+// the obstacle mask as it is streamed in
+#define CHECKPOINT_MAGIC 0x464c5544 // "FLUD"
+#define CHECKPOINT_HEADER 4
+#define CHECKPOINT_PLANES 10
+#define CHECKPOINT_WORDS(n) (CHECKPOINT_HEADER + CHECKPOINT_PLANES * ((n) + 2) * ((n) + 2) + ((n) + 2) * OBSTACLE_ROW_BEATS(n))
+
+// Stages of the per-stage cycle profile fluidsimulation_compute reports
+#define STAGE_SOURCES 0 // Reading and adding the source records
+#define STAGE_FORCES 1  // Vorticity confinement and buoyancy
+#define STAGE_DIFFUSE 2
+#define STAGE_PROJECT 3
+#define STAGE_ADVECT 4
+#define STAGE_OUTPUT 5
+#define STAGE_COUNT 6
+
+// Fields selectable in the output mask of fluidsimulation_compute
+#define OUTPUT_DENSITY 1
+#define OUTPUT_U 2
+#define OUTPUT_V 4
+#define OUTPUT_PRESSURE 8
+#define OUTPUT_DIVERGENCE 16
+#define OUTPUT_TEMPERATURE 32
+#define OUTPUT_FIELDS 6
+
+// Output word formats
+#define OUTPUT_INT 0      // One value * 16 as int per beat
+#define OUTPUT_PACKED16 1 // Two output_packed_type values per beat, the first one in the low half
+#define OUTPUT_DELTA8 2   // Density only, 8-bit and delta / run-length coded, see below
+
+// OUTPUT_DELTA8 frames start with a header beat, (n + 2) | keyframe << 16,
+// followed by a byte stream packed four bytes per beat, the first one in the
+// low byte, and end with TLAST. Each cell is quantised to
+// q = density * DELTA8_SCALE saturated to 0..255 and sent as the byte
+// q - previous q (mod 256), previous q being 0 in keyframes. A byte 0x80
+// escapes the next one: 0 stands for the difference 0x80 itself, r > 0 for
+// r unchanged cells. Bytes after the last cell are padding.
+#define DELTA8_SCALE 2.0
+#define DELTA8_ESCAPE 0x80
+#define DELTA8_KEYFRAME_INTERVAL 32 // Frames between keyframes, a new grid size forces one
+
+// Output layouts
+#define OUTPUT_INTERLEAVED 0 // The selected fields of a cell follow each other
+#define OUTPUT_PLANAR 1      // One whole grid per selected field, in mask bit order
 
 typedef ap_fixed<32, 16> data_type;
 //typedef float data_type;
 
+typedef ap_fixed<16, 10, AP_RND, AP_SAT> output_packed_type;
+typedef ap_fixed<24, 9> coord_type; // Window engine backtrace coordinates, up to +-255 cells
+typedef ap_fixed<24, 9, AP_TRN, AP_SAT> displacement_type; // Backtrace before its clamp, saturates on fast flows
+
 typedef  hls::axis<int, 0, 0, 0, (AXIS_ENABLE_KEEP | AXIS_ENABLE_LAST | AXIS_ENABLE_STRB), false> packet;
 
-extern int fluidsimulation_compute(hls::stream<packet> &output_stream, int &frame);
\ No newline at end of file
+extern int fluidsimulation_compute(int mode, int *checkpoint,
+                                   hls::stream<packet> &source_stream, hls::stream<packet> &output_stream,
+                                   int num_sources, int num_frames, int frame_stride, int n, float tolerance, int &iterations,
+                                   long long profile[STAGE_COUNT], const volatile long long *cycle_counter, int output_mask,
+                                   int output_format, int output_layout);
+
+// Free-running counter for the cycle_counter input above. It is a top of its
+// own: synthesize it in a separate solution with set_top
+// fluidsimulation_cycle_counter, not alongside fluidsimulation_compute, and
+// connect the two IPs in the block design.
+extern void fluidsimulation_cycle_counter(volatile long long *count);
+
+#ifndef __SYNTHESIS__
+// C simulation only: prints the wall time of every stage in the last call
+extern void fluidsimulation_print_profile();
+#endif
\ No newline at end of file
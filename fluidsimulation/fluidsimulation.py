@@ -1,5 +1,7 @@
 import numpy as np
 import time
+import ctypes
+import os
 import matplotlib.pyplot as plt
 from matplotlib import animation
 
@@ -9,6 +11,15 @@ dt = 0.1        # Time step
 diff = 0.0      # Diffusion rate
 visc = 0.0001   # Viscosity
 
+# Native multithreaded backend, build it first with
+#   g++ -O3 -ffp-contract=off -shared -fPIC -pthread fluidsimulation_host.cpp -o libfluidsimulation_host.so
+# It follows the kernel, not the numpy code below: with HOST_FLUID_FORCES set
+# the sources also heat the fluid and buoyancy and vorticity confinement act
+# on the velocity, so its smoke moves differently. Buoyancy lifts along +x_pos,
+# up in the plot below.
+use_host_backend = False
+host_threads = 4
+
 #to measure execution time
 acc_update_time = 0
 update_count = 0
@@ -113,6 +124,18 @@ v_prev = np.zeros((size, size))
 dens = np.zeros((size, size))
 dens_prev = np.zeros((size, size))
 
+host = None
+if use_host_backend:
+    lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), "libfluidsimulation_host.so"))
+    lib.fluid_host_create.restype = ctypes.c_void_p
+    lib.fluid_host_create.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float]
+    lib.fluid_host_set_source.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_float]
+    lib.fluid_host_step.argtypes = [ctypes.c_void_p]
+    lib.fluid_host_density.restype = ctypes.POINTER(ctypes.c_float)
+    lib.fluid_host_density.argtypes = [ctypes.c_void_p]
+    lib.fluid_host_destroy.argtypes = [ctypes.c_void_p]
+    host = lib.fluid_host_create(N, host_threads, dt, diff, visc)
+
 # Set up visualization
 fig, ax = plt.subplots(figsize=(6,6))
 im = ax.imshow(dens[1:N+1,1:N+1], cmap='cividis', origin='lower',
@@ -142,9 +165,15 @@ def update(frame):
             dens_prev[x_pos, y_pos] = 200
             u_prev[x_pos, y_pos] = 50 * np.cos(angle)
             v_prev[x_pos, y_pos] = 50 * np.sin(angle)
-
-    vel_step(u, v, u_prev, v_prev, visc, dt)
-    dens_step(dens, dens_prev, u, v, diff, dt)
+            if host:
+                lib.fluid_host_set_source(host, x_pos, y_pos, 200, 50 * np.cos(angle), 50 * np.sin(angle), 10)
+
+    if host:
+        lib.fluid_host_step(host)
+        dens = np.ctypeslib.as_array(lib.fluid_host_density(host), shape=(size, size))
+    else:
+        vel_step(u, v, u_prev, v_prev, visc, dt)
+        dens_step(dens, dens_prev, u, v, diff, dt)
     
     end_time = time.time()
     
@@ -166,4 +195,10 @@ def update(frame):
 
 # Run animation
 ani = animation.FuncAnimation(fig, update, frames=300, interval=30, blit=False)
-plt.show()
+try:
+    plt.show()
+finally:
+    # Stops the worker threads and frees the fields, dens points into them
+    if host:
+        lib.fluid_host_destroy(host)
+        host = None
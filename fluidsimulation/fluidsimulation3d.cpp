@@ -0,0 +1,380 @@
+#include "fluidsimulation3d.h"
+
+// The SLICES3 slice buffers, shared by all passes, which run one after the
+// other. window holds slices k - 1, k and k + 1 of the stencil input at index
+// k % 3.
+static data_type window[3][MAX_SIZE3][MAX_SIZE3];
+static data_type slice_a[MAX_SIZE3][MAX_SIZE3];
+static data_type slice_b[MAX_SIZE3][MAX_SIZE3];
+static data_type slice_c[MAX_SIZE3][MAX_SIZE3];
+
+static data_type *plane(data_type *fields, int f, int n)
+{
+#pragma HLS INLINE
+    int s = n + 2;
+    return fields + f * s * s * s;
+}
+
+static void load_slice(data_type *field, int k, int n, data_type slice[MAX_SIZE3][MAX_SIZE3])
+{
+#pragma HLS INLINE off
+    int s = n + 2;
+    data_type *src = field + k * s * s;
+load_slice_i_loop:
+    for (int i = 0; i < s; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+    load_slice_j_loop:
+        for (int j = 0; j < s; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+#pragma HLS PIPELINE II = 1
+            slice[i][j] = src[i * s + j];
+        }
+    }
+}
+
+static void store_slice(data_type *field, int k, int n, data_type slice[MAX_SIZE3][MAX_SIZE3], bool negate)
+{
+#pragma HLS INLINE off
+    int s = n + 2;
+    data_type *dst = field + k * s * s;
+store_slice_i_loop:
+    for (int i = 0; i < s; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+    store_slice_j_loop:
+        for (int j = 0; j < s; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+#pragma HLS PIPELINE II = 1
+            dst[i * s + j] = negate ? data_type(-slice[i][j]) : slice[i][j];
+        }
+    }
+}
+
+// x and y faces of one slice, as set_bnd in 2D: b = 1 negates the x faces,
+// b = 2 the y faces, the edges get the mean of their two neighbours.
+static void set_bnd_slice(int b, data_type x[MAX_SIZE3][MAX_SIZE3], int n)
+{
+#pragma HLS INLINE off
+set_bnd_slice_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+#pragma HLS PIPELINE off
+        x[0][i] = (b == 1) ? data_type(-x[1][i]) : x[1][i];
+        x[n + 1][i] = (b == 1) ? data_type(-x[n][i]) : x[n][i];
+        x[i][0] = (b == 2) ? data_type(-x[i][1]) : x[i][1];
+        x[i][n + 1] = (b == 2) ? data_type(-x[i][n]) : x[i][n];
+    }
+
+    x[0][0] = data_type(0.5) * (x[1][0] + x[0][1]);
+    x[0][n + 1] = data_type(0.5) * (x[1][n + 1] + x[0][n]);
+    x[n + 1][0] = data_type(0.5) * (x[n][0] + x[n + 1][1]);
+    x[n + 1][n + 1] = data_type(0.5) * (x[n][n + 1] + x[n + 1][n]);
+}
+
+// Writes interior slice k with its x and y faces fixed up. Slices 1 and n are
+// mirrored onto the z faces 0 and n + 1 as well, negated for b = 3. This is
+// the 6-face set_bnd done while streaming.
+static void store_slice_bnd(int b, data_type *field, int k, int n, data_type slice[MAX_SIZE3][MAX_SIZE3])
+{
+#pragma HLS INLINE
+    set_bnd_slice(b, slice, n);
+    store_slice(field, k, n, slice, false);
+    if (k == 1)
+        store_slice(field, 0, n, slice, b == 3);
+    if (k == n)
+        store_slice(field, n + 1, n, slice, b == 3);
+}
+
+// One Jacobi sweep of the 7-point system, x_out from x_in
+static void jacobi_sweep(int b, data_type *x_out, data_type *x_in, data_type *x0, float a, float c, int n)
+{
+#pragma HLS INLINE off
+    load_slice(x_in, 0, n, window[0]);
+    load_slice(x_in, 1, n, window[1]);
+
+jacobi_k_loop:
+    for (int k = 1; k <= n; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        load_slice(x_in, k + 1, n, window[(k + 1) % 3]);
+        load_slice(x0, k, n, slice_a);
+
+        int below = (k - 1) % 3;
+        int centre = k % 3;
+        int above = (k + 1) % 3;
+    jacobi_i_loop:
+        for (int i = 1; i <= n; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        jacobi_j_loop:
+            for (int j = 1; j <= n; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+#pragma HLS PIPELINE II = 1
+                slice_b[i][j] = (slice_a[i][j] + data_type(a) * (window[centre][i - 1][j] + window[centre][i + 1][j] +
+                                                                 window[centre][i][j - 1] + window[centre][i][j + 1] +
+                                                                 window[below][i][j] + window[above][i][j])) /
+                                data_type(c);
+            }
+        }
+        store_slice_bnd(b, x_out, k, n, slice_b);
+    }
+}
+
+// Even iteration counts, x is also the initial guess
+static void lin_solve3(int b, data_type *x, data_type *x0, data_type *tmp, float a, float c, int iters, int n)
+{
+#pragma HLS INLINE off
+lin_solve3_loop:
+    for (int k = 0; k < iters; k += 2)
+    {
+        jacobi_sweep(b, tmp, x, x0, a, c, n);
+        jacobi_sweep(b, x, tmp, x0, a, c, n);
+    }
+}
+
+static void diffuse3(int b, data_type *x, data_type *x0, data_type *tmp, float diff, float dt, int n)
+{
+#pragma HLS INLINE off
+    float a = dt * diff * n * n;
+    lin_solve3(b, x, x0, tmp, a, 1 + 6 * a, DIFFUSE3_ITERS, n);
+}
+
+// Semi-Lagrangian advection with trilinear interpolation. The z displacement
+// is clamped to ADVECT3_MAX_DZ, so the taps always fall into the three slices
+// of the window; x and y are free within the slice. Each cell reads the window
+// eight times at slice indices only known at run time, so the loop runs at
+// II = 4 on the two ports of each slice.
+static void advect3(int b, data_type *d, data_type *d0, data_type *u, data_type *v, data_type *w, float dt, int n)
+{
+#pragma HLS INLINE off
+    float dt0 = dt * n;
+
+    load_slice(d0, 0, n, window[0]);
+    load_slice(d0, 1, n, window[1]);
+
+advect3_k_loop:
+    for (int k = 1; k <= n; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        load_slice(d0, k + 1, n, window[(k + 1) % 3]);
+        load_slice(u, k, n, slice_a);
+        load_slice(v, k, n, slice_b);
+        load_slice(w, k, n, slice_c);
+
+    advect3_i_loop:
+        for (int i = 1; i <= n; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        advect3_j_loop:
+            for (int j = 1; j <= n; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+#pragma HLS PIPELINE II = 4
+                float dz = data_type(dt0) * slice_c[i][j];
+                if (dz > ADVECT3_MAX_DZ)
+                    dz = ADVECT3_MAX_DZ;
+                if (dz < -ADVECT3_MAX_DZ)
+                    dz = -ADVECT3_MAX_DZ;
+
+                float x = i - data_type(dt0) * slice_a[i][j];
+                float y = j - data_type(dt0) * slice_b[i][j];
+                float z = k - dz;
+
+                if (x < 0.5)
+                    x = 0.5;
+                if (x > n + 0.5)
+                    x = n + 0.5;
+                if (y < 0.5)
+                    y = 0.5;
+                if (y > n + 0.5)
+                    y = n + 0.5;
+                if (z < 0.5)
+                    z = 0.5;
+                if (z > n + 0.5)
+                    z = n + 0.5;
+
+                int i0 = (int)x;
+                int j0 = (int)y;
+                int k0 = (int)z;
+                // z = k + 1 exactly takes all of its weight from slice k + 1
+                if (k0 > k)
+                    k0 = k;
+
+                float s1 = x - i0;
+                float s0 = 1 - s1;
+                float t1 = y - j0;
+                float t0 = 1 - t1;
+                float r1 = z - k0;
+                float r0 = 1 - r1;
+
+                int lo = k0 % 3;
+                int hi = (k0 + 1) % 3;
+                data_type plane_lo = data_type(s0) * (data_type(t0) * window[lo][i0][j0] + data_type(t1) * window[lo][i0][j0 + 1]) +
+                                     data_type(s1) * (data_type(t0) * window[lo][i0 + 1][j0] + data_type(t1) * window[lo][i0 + 1][j0 + 1]);
+                data_type plane_hi = data_type(s0) * (data_type(t0) * window[hi][i0][j0] + data_type(t1) * window[hi][i0][j0 + 1]) +
+                                     data_type(s1) * (data_type(t0) * window[hi][i0 + 1][j0] + data_type(t1) * window[hi][i0 + 1][j0 + 1]);
+                slice_a[i][j] = data_type(r0) * plane_lo + data_type(r1) * plane_hi;
+            }
+        }
+        // slice_a is read before it is overwritten for every cell, so it can
+        // take the result
+        store_slice_bnd(b, d, k, n, slice_a);
+    }
+}
+
+// Divergence of (u, v, w) into div_, clears p
+static void divergence3(data_type *u, data_type *v, data_type *w, data_type *p, data_type *div_, int n)
+{
+#pragma HLS INLINE off
+    load_slice(w, 0, n, window[0]);
+    load_slice(w, 1, n, window[1]);
+
+divergence3_k_loop:
+    for (int k = 1; k <= n; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        load_slice(w, k + 1, n, window[(k + 1) % 3]);
+        load_slice(u, k, n, slice_a);
+        load_slice(v, k, n, slice_b);
+
+        int below = (k - 1) % 3;
+        int above = (k + 1) % 3;
+    divergence3_i_loop:
+        for (int i = 1; i <= n; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        divergence3_j_loop:
+            for (int j = 1; j <= n; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+#pragma HLS PIPELINE II = 1
+                slice_c[i][j] = data_type(-0.5) * ((slice_a[i + 1][j] - slice_a[i - 1][j]) +
+                                                   (slice_b[i][j + 1] - slice_b[i][j - 1]) +
+                                                   (window[above][i][j] - window[below][i][j])) / n;
+            }
+        }
+        store_slice_bnd(0, div_, k, n, slice_c);
+
+    divergence3_clear_i_loop:
+        for (int i = 0; i <= n + 1; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+        divergence3_clear_j_loop:
+            for (int j = 0; j <= n + 1; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE3
+#pragma HLS PIPELINE II = 1
+                slice_c[i][j] = 0;
+            }
+        }
+        store_slice_bnd(0, p, k, n, slice_c);
+    }
+}
+
+// Subtracts the pressure gradient from (u, v, w)
+static void gradient3(data_type *u, data_type *v, data_type *w, data_type *p, int n)
+{
+#pragma HLS INLINE off
+    load_slice(p, 0, n, window[0]);
+    load_slice(p, 1, n, window[1]);
+
+gradient3_k_loop:
+    for (int k = 1; k <= n; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        load_slice(p, k + 1, n, window[(k + 1) % 3]);
+        load_slice(u, k, n, slice_a);
+        load_slice(v, k, n, slice_b);
+        load_slice(w, k, n, slice_c);
+
+        int below = (k - 1) % 3;
+        int centre = k % 3;
+        int above = (k + 1) % 3;
+    gradient3_i_loop:
+        for (int i = 1; i <= n; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+        gradient3_j_loop:
+            for (int j = 1; j <= n; j++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N3
+#pragma HLS PIPELINE II = 1
+                slice_a[i][j] -= data_type(0.5) * n * (window[centre][i + 1][j] - window[centre][i - 1][j]);
+                slice_b[i][j] -= data_type(0.5) * n * (window[centre][i][j + 1] - window[centre][i][j - 1]);
+                slice_c[i][j] -= data_type(0.5) * n * (window[above][i][j] - window[below][i][j]);
+            }
+        }
+        store_slice_bnd(1, u, k, n, slice_a);
+        store_slice_bnd(2, v, k, n, slice_b);
+        store_slice_bnd(3, w, k, n, slice_c);
+    }
+}
+
+static void project3(data_type *u, data_type *v, data_type *w, data_type *p, data_type *div_, data_type *tmp, int n)
+{
+#pragma HLS INLINE off
+    divergence3(u, v, w, p, div_, n);
+    lin_solve3(0, p, div_, tmp, 1, 6, PROJECT3_ITERS, n);
+    gradient3(u, v, w, p, n);
+}
+
+// The velocity in U, V, W (sources already added) ends up there again, U0,
+// V0, W0 hold the diffused velocity the advection reads
+static void vel_step3(data_type *fields, float visc, float dt, int n)
+{
+#pragma HLS INLINE off
+    data_type *u = plane(fields, FIELD3_U, n);
+    data_type *v = plane(fields, FIELD3_V, n);
+    data_type *w = plane(fields, FIELD3_W, n);
+    data_type *u0 = plane(fields, FIELD3_U0, n);
+    data_type *v0 = plane(fields, FIELD3_V0, n);
+    data_type *w0 = plane(fields, FIELD3_W0, n);
+    data_type *p = plane(fields, FIELD3_P, n);
+    data_type *tmp = plane(fields, FIELD3_TMP, n);
+    data_type *div_ = plane(fields, FIELD3_DIV, n);
+
+    diffuse3(1, u0, u, tmp, visc, dt, n);
+    diffuse3(2, v0, v, tmp, visc, dt, n);
+    diffuse3(3, w0, w, tmp, visc, dt, n);
+    project3(u0, v0, w0, p, div_, tmp, n);
+
+    advect3(1, u, u0, u0, v0, w0, dt, n);
+    advect3(2, v, v0, u0, v0, w0, dt, n);
+    advect3(3, w, w0, u0, v0, w0, dt, n);
+    project3(u, v, w, p, div_, tmp, n);
+}
+
+static void dens_step3(data_type *fields, float diff, float dt, int n)
+{
+#pragma HLS INLINE off
+    data_type *dens = plane(fields, FIELD3_DENS, n);
+    data_type *dens0 = plane(fields, FIELD3_DENS0, n);
+
+    diffuse3(0, dens0, dens, plane(fields, FIELD3_TMP, n), diff, dt, n);
+    advect3(0, dens, dens0, plane(fields, FIELD3_U, n), plane(fields, FIELD3_V, n), plane(fields, FIELD3_W, n), dt, n);
+}
+
+// One frame of the n x n x n grid in fields, laid out as FIELD3_*. The host
+// zeroes the buffer once, adds DT times its sources to U, V, W and DENS before
+// each call and reads DENS afterwards.
+int fluidsimulation3d_compute(data_type *fields, int n)
+{
+#pragma HLS INTERFACE mode = m_axi port = fields offset = slave bundle = gmem depth = FIELD3_WORDS(MAX_N3) max_read_burst_length = 256 max_write_burst_length = 256
+#pragma HLS INTERFACE mode = s_axilite port = fields
+#pragma HLS INTERFACE mode = s_axilite port = n
+#pragma HLS INTERFACE mode = s_axilite port = return
+#pragma HLS ARRAY_PARTITION variable = window complete dim = 1
+
+    if (n < 2 || n > MAX_N3)
+        return -1;
+
+    vel_step3(fields, VISC, DT, n);
+    dens_step3(fields, DIFF, DT, n);
+
+    return 0;
+}
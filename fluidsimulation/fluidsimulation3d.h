@@ -0,0 +1,44 @@
+#pragma once
+
+#include "fluidsimulation.h"
+
+// Volumetric variant of the fluid simulation. The fields live in DDR, one
+// (n + 2)^3 plane per field with contiguous z-slices, and every pass streams
+// them through the kernel slice by slice, so BRAM scales with n^2 instead of
+// n^3. 7-point stencils need a window of three input slices. Three more hold
+// the right-hand side or velocities of the same k and the output slice. That
+// makes six MAX_SIZE3^2 slices on chip, 6 * 66 * 66 words or about 102 KB at
+// MAX_N3 64, some 30 BRAM36 with 32-bit data_type.
+#define MAX_N3 64             // Largest grid size
+#define MAX_SIZE3 (MAX_N3 + 2) // Slice dimension including boundaries
+#define SLICES3 6             // MAX_SIZE3^2 slice buffers the kernel keeps on chip
+
+// The time step is DT of fluidsimulation.h. advect3 only sees the window, so
+// its backtrace can reach at most ADVECT3_MAX_DZ slices in z. That is a CFL
+// limit of |w| * DT * n <= ADVECT3_MAX_DZ, |w| <= 0.156 at n = 64. Faster
+// vertical flows are clamped and carry less than they should, they do not
+// blow up. x and y reach across the whole slice.
+#define ADVECT3_MAX_DZ 1
+
+// Jacobi sweeps, each one streams the grid once. Even counts leave the result
+// in the field instead of its scratch plane.
+#define DIFFUSE3_ITERS 20
+#define PROJECT3_ITERS 40
+
+// Field planes of the DDR buffer, cell (i, j, k) of plane f is at
+// f * (n + 2)^3 + (k * (n + 2) + i) * (n + 2) + j
+#define FIELD3_U 0
+#define FIELD3_V 1
+#define FIELD3_W 2
+#define FIELD3_U0 3
+#define FIELD3_V0 4
+#define FIELD3_W0 5
+#define FIELD3_DENS 6
+#define FIELD3_DENS0 7
+#define FIELD3_P 8
+#define FIELD3_TMP 9 // Jacobi ping-pong scratch
+#define FIELD3_DIV 10
+#define FIELD3_COUNT 11
+#define FIELD3_WORDS(n) (FIELD3_COUNT * ((n) + 2) * ((n) + 2) * ((n) + 2))
+
+extern int fluidsimulation3d_compute(data_type *fields, int n);
@@ -0,0 +1,215 @@
+#include <iostream>
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "fluidsimulation3d.h"
+
+#define N3 24 // Grid size used by the testbench
+#define SIZE3 (N3 + 2)
+
+static int cell(int f, int i, int j, int k)
+{
+    return f * SIZE3 * SIZE3 * SIZE3 + (k * SIZE3 + i) * SIZE3 + j;
+}
+
+// Largest divergence of the velocity, in the units of the divergence pass
+static float max_divergence(const std::vector<data_type> &fields)
+{
+    float max_div = 0;
+    for (int k = 2; k < N3; k++)
+    {
+        for (int i = 2; i < N3; i++)
+        {
+            for (int j = 2; j < N3; j++)
+            {
+                float d = std::fabs(float((fields[cell(FIELD3_U, i + 1, j, k)] - fields[cell(FIELD3_U, i - 1, j, k)]) +
+                                          (fields[cell(FIELD3_V, i, j + 1, k)] - fields[cell(FIELD3_V, i, j - 1, k)]) +
+                                          (fields[cell(FIELD3_W, i, j, k + 1)] - fields[cell(FIELD3_W, i, j, k - 1)])));
+                if (d > max_div)
+                    max_div = d;
+            }
+        }
+    }
+    return max_div;
+}
+
+// Largest |w| of the grid
+static float max_w(const std::vector<data_type> &fields)
+{
+    float max_speed = 0;
+    for (int k = 1; k <= N3; k++)
+    {
+        for (int i = 1; i <= N3; i++)
+        {
+            for (int j = 1; j <= N3; j++)
+            {
+                float speed = std::fabs(float(fields[cell(FIELD3_W, i, j, k)]));
+                if (speed > max_speed)
+                    max_speed = speed;
+            }
+        }
+    }
+    return max_speed;
+}
+
+// Density weighted mean k of the grid
+static float density_centre_k(const std::vector<data_type> &fields)
+{
+    float mass = 0, moment = 0;
+    for (int k = 1; k <= N3; k++)
+    {
+        for (int i = 1; i <= N3; i++)
+        {
+            for (int j = 1; j <= N3; j++)
+            {
+                float d = float(fields[cell(FIELD3_DENS, i, j, k)]);
+                mass += d;
+                moment += d * k;
+            }
+        }
+    }
+    return moment / mass;
+}
+
+// Carries a density blob on a divergence-free pair of rolls in the i-k plane
+// that rises through the middle of the grid, within the CFL limit of
+// ADVECT3_MAX_DZ. Returns how many slices the blob moved and, in expected,
+// the displacement w * DT * n summed over the frames at its centre.
+static float blob_rise(float &expected)
+{
+    std::vector<data_type> fields(FIELD3_WORDS(N3), data_type(0));
+
+    // Stream function sin(2 pi i / (n + 1)) sin(pi k / (n + 1)), w at its
+    // peak in the middle of the grid
+    const float peak_w = 0.25f;
+    const float a = 2.0f * float(M_PI) / (N3 + 1), c = float(M_PI) / (N3 + 1);
+    const int ic = (N3 + 1) / 2, jc = (N3 + 1) / 2, kc = N3 / 2 - 3;
+    for (int k = 1; k <= N3; k++)
+    {
+        for (int i = 1; i <= N3; i++)
+        {
+            for (int j = 1; j <= N3; j++)
+            {
+                fields[cell(FIELD3_U, i, j, k)] = data_type(0.5f * peak_w * std::sin(a * i) * std::cos(c * k));
+                fields[cell(FIELD3_W, i, j, k)] = data_type(-peak_w * std::cos(a * i) * std::sin(c * k));
+                float r2 = (i - ic) * (i - ic) + (j - jc) * (j - jc) + (k - kc) * (k - kc);
+                fields[cell(FIELD3_DENS, i, j, k)] = data_type(10.0f * std::exp(-r2 / 2.0f));
+            }
+        }
+    }
+
+    float start = density_centre_k(fields);
+    expected = 0;
+    for (int frame = 0; frame < 4; frame++)
+    {
+        fluidsimulation3d_compute(fields.data(), N3);
+        int k = (int)(density_centre_k(fields) + 0.5f);
+        expected += float(fields[cell(FIELD3_W, ic, jc, k)]) * DT * N3;
+    }
+    return density_centre_k(fields) - start;
+}
+
+int main()
+{
+    std::vector<data_type> fields(FIELD3_WORDS(N3), data_type(0));
+
+    float expected_rise;
+    float rise = blob_rise(expected_rise);
+    std::cout << "blob rise: " << rise << " slices, expected " << expected_rise << std::endl;
+    if (std::fabs(rise - expected_rise) > 0.25f * expected_rise)
+    {
+        std::cout << "density blob did not move with w" << std::endl;
+        return 1;
+    }
+
+    // A smoke source near the bottom face pushing upwards in z, with a slight
+    // sideways swirl. w peaks around 0.27, within the CFL limit of
+    // ADVECT3_MAX_DZ; beyond it the z advection clamps and loses mass.
+    const int frames = 20;
+    float max_speed = 0;
+    float before_div = 0; // Divergence of the last frame's input, sources included
+    for (int frame = 0; frame < frames; frame++)
+    {
+        int i = N3 / 2, j = N3 / 2, k = 3;
+        fields[cell(FIELD3_DENS, i, j, k)] += data_type(DT * 200.0);
+        fields[cell(FIELD3_W, i, j, k)] += data_type(DT * 8.0);
+        fields[cell(FIELD3_U, i, j, k)] += data_type(DT * 10.0 * std::cos(0.3 * frame));
+        fields[cell(FIELD3_V, i, j, k)] += data_type(DT * 10.0 * std::sin(0.3 * frame));
+
+        before_div = max_divergence(fields);
+        if (fluidsimulation3d_compute(fields.data(), N3) != 0)
+        {
+            std::cout << "fluidsimulation3d_compute rejected the grid size" << std::endl;
+            return 1;
+        }
+        float speed = max_w(fields);
+        if (speed > max_speed)
+            max_speed = speed;
+    }
+    if (max_speed * DT * N3 > ADVECT3_MAX_DZ)
+    {
+        std::cout << "w passed the CFL limit of the z advection: " << max_speed << std::endl;
+        return 1;
+    }
+
+    float mass = 0;
+    for (int k = 1; k <= N3; k++)
+    {
+        for (int i = 1; i <= N3; i++)
+        {
+            for (int j = 1; j <= N3; j++)
+            {
+                float d = float(fields[cell(FIELD3_DENS, i, j, k)]);
+                if (!(d >= -1e-3f))
+                {
+                    std::cout << "negative or invalid density" << std::endl;
+                    return 1;
+                }
+                mass += d;
+            }
+        }
+    }
+
+    // The z faces mirror the first and last slice, w negated
+    for (int i = 1; i <= N3; i++)
+    {
+        for (int j = 1; j <= N3; j++)
+        {
+            if (fields[cell(FIELD3_DENS, i, j, 0)] != fields[cell(FIELD3_DENS, i, j, 1)] ||
+                fields[cell(FIELD3_W, i, j, N3 + 1)] != data_type(-fields[cell(FIELD3_W, i, j, N3)]))
+            {
+                std::cout << "z faces are not mirrored" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Jacobi converges slowly on the smooth modes, so only ask the projection
+    // to remove most of what the sources injected
+    float max_div = max_divergence(fields);
+    std::cout << "density mass: " << mass << " max w: " << max_speed << " max divergence: " << before_div << " -> "
+              << max_div << std::endl;
+    if (mass <= 0 || max_div > 0.5f * before_div)
+    {
+        std::cout << "projection left the velocity divergent" << std::endl;
+        return 1;
+    }
+
+    // Slice through the source, i horizontal and k vertical
+    cv::Mat output_buffer(SIZE3, SIZE3, CV_8UC1, cv::Scalar(0));
+    for (int k = 0; k < SIZE3; k++)
+    {
+        for (int i = 0; i < SIZE3; i++)
+        {
+            float d = float(fields[cell(FIELD3_DENS, i, N3 / 2, k)]) * 16;
+            output_buffer.at<unsigned char>(SIZE3 - 1 - k, i) = (unsigned char)(d > 255 ? 255 : d);
+        }
+    }
+    cv::imwrite("fluidsimulation3d_ouput.png", output_buffer);
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+// Runs the fluid simulation with several scalar types against a double
+// precision reference, followed by the multithreaded host backend. Host only,
+// build with
+//   g++ -O2 -ffp-contract=off -pthread -I$XILINX_HLS/include fluidsimulation_bench.cpp fluidsimulation_host.cpp -o fluidsimulation_bench
+//
+// The full simulation is chaotic: any rounding difference grows until the
+// runs share nothing but their statistics, whatever the type. So it only
+// reports how long a type tracks the reference and whether it stays
+// stable. Precision itself is measured on a flow that does not amplify
+// errors, the density carried around a fixed vortex.
+
+// The host backend sweeps in red-black order, the kernel has to do the same
+// for the bit-exactness check below
+#ifndef SOLVER
+#define SOLVER SOLVER_RED_BLACK
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdio.h>
+
+#include "fluidsimulation_solver.h"
+#include "fluidsimulation_host.h"
+
+static_assert(HOST_FLUID_FORCES == FLUID_FORCES, "the host backend has to add the same forces as the kernel");
+
+#define BENCH_N 50             // Grid size
+#define BENCH_FRAMES 200       // Frames simulated per type
+#define BENCH_TOLERANCE 0      // Solver tolerance, 0 runs the full sweep counts
+#define BENCH_THREADS 4        // Threads of the host backend
+#define BENCH_SHORT_FRAMES 10  // Lockstep error horizon, before chaos takes over
+#define BENCH_ERROR_LIMIT 0.01 // Density error, relative to the reference peak, that ends tracking
+#define BENCH_BLOWUP 1000.0    // Field magnitude counted as a blow-up, far beyond anything physical here
+#define BENCH_VORTEX 0.5       // Angular speed of the fixed vortex, about 1.6 turns in BENCH_FRAMES
+#define BENCH_VORTEX_DIFF 0.0001 // Diffusion rate of the vortex run
+
+static volatile long long bench_clock; // Only the kernel has a cycle counter, steady_clock times the stages here
+static fluid_state<double> reference;
+static fluid_state<double> state_double;
+static fluid_state<float> state_float;
+static fluid_state<ap_fixed<32, 16> > state_fixed_32_16;
+static fluid_state<ap_fixed<24, 12> > state_fixed_24_12;
+
+template <typename T>
+static double density_mass(fluid_state<T> &state, int n)
+{
+    double mass = 0;
+    for (int i = 1; i <= n; i++)
+        for (int j = 1; j <= n; j++)
+            mass += double(state.dens[state.dens_bank][i][j]);
+    return mass;
+}
+
+template <typename T>
+static double kinetic_energy(fluid_state<T> &state, int n)
+{
+    double energy = 0;
+    for (int i = 1; i <= n; i++)
+    {
+        for (int j = 1; j <= n; j++)
+        {
+            double u = double(state.u[state.vel_bank][i][j]);
+            double v = double(state.v[state.vel_bank][i][j]);
+            energy += 0.5 * (u * u + v * v);
+        }
+    }
+    return energy;
+}
+
+// True if a field holds NaN, infinity or a value beyond BENCH_BLOWUP. A
+// wrapping fixed point type overflows into the latter.
+template <typename T>
+static bool blown_up(fluid_state<T> &state, int n)
+{
+    for (int i = 0; i < n + 2; i++)
+    {
+        for (int j = 0; j < n + 2; j++)
+        {
+            double values[3] = {double(state.dens[state.dens_bank][i][j]), double(state.u[state.vel_bank][i][j]),
+                                double(state.v[state.vel_bank][i][j])};
+            for (int k = 0; k < 3; k++)
+                if (!(std::fabs(values[k]) <= BENCH_BLOWUP))
+                    return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+static double max_density_error(fluid_state<T> &state, fluid_state<double> &other, int n, double &peak)
+{
+    double max_error = 0;
+    peak = 0;
+    for (int i = 1; i <= n; i++)
+    {
+        for (int j = 1; j <= n; j++)
+        {
+            double value = other.dens[other.dens_bank][i][j];
+            double error = std::fabs(double(state.dens[state.dens_bank][i][j]) - value);
+            if (!(error <= max_error)) // also catches NaN
+                max_error = error;
+            if (value > peak)
+                peak = value;
+        }
+    }
+    return max_error;
+}
+
+// Density carried around a fixed vortex for BENCH_FRAMES frames, diffusion
+// and advection only. Returns the largest error against the same run in
+// double, and the mass drift in drift.
+template <typename T>
+static double vortex_error(fluid_state<T> &state, int n, double &drift)
+{
+    fluid_reset(reference);
+    fluid_reset(state);
+
+    double c = 0.5 * (n + 1);
+    for (int i = 1; i <= n; i++)
+    {
+        for (int j = 1; j <= n; j++)
+        {
+            double u = -BENCH_VORTEX * (j - c) / n, v = BENCH_VORTEX * (i - c) / n;
+            double di = i - 0.35 * n, dj = j - 0.5 * n;
+            double d = std::exp(-(di * di + dj * dj) / (0.01 * n * n));
+            state.u[state.vel_bank][i][j] = T(u);
+            state.v[state.vel_bank][i][j] = T(v);
+            state.dens[state.dens_bank][i][j] = T(d);
+            reference.u[reference.vel_bank][i][j] = u;
+            reference.v[reference.vel_bank][i][j] = v;
+            reference.dens[reference.dens_bank][i][j] = d;
+        }
+    }
+
+    double start_mass = density_mass(reference, n);
+    double max_error = 0, peak;
+    drift = 0;
+    for (int frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        dens_step(state.dens, state.dens_bank, state.u[state.vel_bank], state.v[state.vel_bank], state.tmp,
+                  BENCH_VORTEX_DIFF, DT, BENCH_TOLERANCE, state.obstacles, state.profile, bench_clock, n);
+        dens_step(reference.dens, reference.dens_bank, reference.u[reference.vel_bank], reference.v[reference.vel_bank],
+                  reference.tmp, BENCH_VORTEX_DIFF, DT, BENCH_TOLERANCE, reference.obstacles, reference.profile, bench_clock, n);
+
+        double error = max_density_error(state, reference, n, peak);
+        if (!(error <= max_error))
+            max_error = error;
+        double frame_drift = std::fabs(density_mass(state, n) - density_mass(reference, n)) / start_mass;
+        if (!(frame_drift <= drift))
+            drift = frame_drift;
+    }
+    return max_error;
+}
+
+template <typename T>
+static void run(const char *name, fluid_state<T> &state, int n, int frames)
+{
+    fluid_reset(reference);
+    fluid_reset(state);
+
+    double total_ms = 0;
+    double short_error = 0;
+    int tracked = -1;  // Frames before the error passed BENCH_ERROR_LIMIT, -1 for all of them
+    int unstable = -1; // First frame that blew up
+    double energy_ratio = 0;
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        fluid_source<T> sources[MAX_SOURCES];
+        int num_sources = orbiting_sources(frame, n, sources);
+
+        auto start = std::chrono::steady_clock::now();
+        fluid_step(state, sources, num_sources, n, BENCH_TOLERANCE, bench_clock);
+        auto end = std::chrono::steady_clock::now();
+        total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+        fluid_source<double> reference_sources[MAX_SOURCES];
+        orbiting_sources(frame, n, reference_sources);
+        fluid_step(reference, reference_sources, num_sources, n, BENCH_TOLERANCE, bench_clock);
+
+        double peak;
+        double error = max_density_error(state, reference, n, peak);
+        if (frame < BENCH_SHORT_FRAMES && !(error <= short_error))
+            short_error = error;
+        if (tracked < 0 && !(error <= BENCH_ERROR_LIMIT * peak))
+            tracked = frame;
+        if (unstable < 0 && blown_up(state, n))
+            unstable = frame;
+
+        double ratio = kinetic_energy(state, n) / kinetic_energy(reference, n);
+        if (!(ratio <= energy_ratio))
+            energy_ratio = ratio;
+    }
+
+    double drift;
+    double flow_error = vortex_error(state, n, drift);
+
+    char tracked_text[16], unstable_text[16];
+    snprintf(tracked_text, sizeof(tracked_text), "%d", tracked < 0 ? frames : tracked);
+    snprintf(unstable_text, sizeof(unstable_text), unstable < 0 ? "-" : "%d", unstable);
+    printf("%-18s %10.3f %14.3e %10s %12.3f %10s %14.3e %12.4f\n", name, total_ms / frames, short_error, tracked_text,
+           energy_ratio, unstable_text, flow_error, 100.0 * drift);
+}
+
+// The host backend is fed the same emitters as the kernel. With
+// SOLVER_RED_BLACK it has to match the float kernel bit for bit, returns false
+// if it does not.
+static bool run_host(const char *name, int threads, int n, int frames)
+{
+    fluid_host *host = fluid_host_create(n, threads, DT, DIFF, VISC);
+    fluid_reset(reference);
+    fluid_reset(state_float);
+
+    double total_ms = 0;
+    double max_error = 0;
+    double max_kernel_error = 0;
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        fluid_source<float> sources[MAX_SOURCES];
+        int num_sources = orbiting_sources(frame, n, sources);
+        for (int k = 0; k < num_sources; k++)
+            fluid_host_set_source(host, sources[k].x, sources[k].y, sources[k].dens, sources[k].u, sources[k].v,
+                                  sources[k].temp);
+
+        fluid_source<double> reference_sources[MAX_SOURCES];
+        orbiting_sources(frame, n, reference_sources);
+
+        auto start = std::chrono::steady_clock::now();
+        fluid_host_step(host);
+        auto end = std::chrono::steady_clock::now();
+        total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+        fluid_step(reference, reference_sources, num_sources, n, BENCH_TOLERANCE, bench_clock);
+        fluid_step(state_float, sources, num_sources, n, BENCH_TOLERANCE, bench_clock);
+
+        const float *dens = fluid_host_density(host);
+        for (int i = 1; i <= n; i++)
+        {
+            for (int j = 1; j <= n; j++)
+            {
+                double error = std::fabs(dens[i * (n + 2) + j] - reference.dens[reference.dens_bank][i][j]);
+                if (!(error <= max_error))
+                    max_error = error;
+                double kernel_error = std::fabs(dens[i * (n + 2) + j] - state_float.dens[state_float.dens_bank][i][j]);
+                if (!(kernel_error <= max_kernel_error))
+                    max_kernel_error = kernel_error;
+            }
+        }
+    }
+
+    fluid_host_destroy(host);
+
+    printf("%-18s %10.3f %14.3e  (max error over all frames)\n", name, total_ms / frames, max_error);
+#if SOLVER == SOLVER_RED_BLACK
+    if (max_kernel_error != 0)
+        printf("  differs from the float kernel by up to %g\n", max_kernel_error);
+    else
+        printf("  bit-exact with the float kernel\n");
+    return max_kernel_error == 0;
+#else
+    return true;
+#endif
+}
+
+int main()
+{
+    printf("grid %d x %d, %d frames\n", BENCH_N, BENCH_N, BENCH_FRAMES);
+    printf("full simulation: density error over the first %d frames, frames tracked within %g%% of the peak,\n",
+           BENCH_SHORT_FRAMES, 100.0 * BENCH_ERROR_LIMIT);
+    printf("largest kinetic energy ratio to double and first frame past %g or not finite;\n", BENCH_BLOWUP);
+    printf("fixed vortex: largest density error and mass drift against double\n");
+    printf("%-18s %10s %14s %10s %12s %10s %14s %12s\n", "type", "ms/frame", "short error", "tracked", "energy x",
+           "blow-up", "vortex error", "drift (%)");
+
+    run("double", state_double, BENCH_N, BENCH_FRAMES);
+    run("float", state_float, BENCH_N, BENCH_FRAMES);
+    run("ap_fixed<32,16>", state_fixed_32_16, BENCH_N, BENCH_FRAMES);
+    run("ap_fixed<24,12>", state_fixed_24_12, BENCH_N, BENCH_FRAMES);
+    bool exact = run_host("host 1 thread", 1, BENCH_N, BENCH_FRAMES);
+    exact &= run_host("host 4 threads", BENCH_THREADS, BENCH_N, BENCH_FRAMES);
+
+    return exact ? 0 : 1;
+}
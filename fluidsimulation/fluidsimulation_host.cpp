@@ -0,0 +1,512 @@
+#include "fluidsimulation_host.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Sweep counts of the kernel, see DIFFUSE_ITERS / PROJECT_ITERS in fluidsimulation.h
+#define HOST_DIFFUSE_ITERS 20
+#define HOST_PROJECT_ITERS 50
+
+// Force constants of the kernel, see VORTICITY_EPS and BUOYANCY_* in fluidsimulation.h,
+// the switch itself is HOST_FLUID_FORCES in fluidsimulation_host.h
+#define HOST_VORTICITY_EPS 2.0
+#define HOST_BUOYANCY_ALPHA 0.01
+#define HOST_BUOYANCY_BETA 0.5
+#define HOST_AMBIENT_TEMPERATURE 0.0
+
+// Barrier the worker threads spin on between passes. A frame has a few
+// hundred passes of a few microseconds each, too short to sleep between.
+class spin_barrier
+{
+public:
+    explicit spin_barrier(int threads) : threads(threads), count(0), generation(0) {}
+
+    void wait()
+    {
+        int gen = generation.load();
+        if (count.fetch_add(1) + 1 == threads)
+        {
+            count.store(0);
+            generation.fetch_add(1);
+        }
+        else
+        {
+            while (generation.load() == gen)
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    int threads;
+    std::atomic<int> count;
+    std::atomic<int> generation;
+};
+
+struct fluid_host
+{
+    int n;
+    int stride;
+    int threads;
+    float dt, diff, visc;
+
+    // Fields and their source / scratch arrays, swapped by pointer
+    std::vector<float> storage;
+    float *u, *v, *u_prev, *v_prev, *dens, *dens_prev, *temp, *temp_prev, *p, *div_;
+
+    spin_barrier barrier;
+
+    // Worker threads sleep between frames
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    int frame_id;
+    int running;
+    bool stop;
+
+    fluid_host(int n, int threads) : n(n), stride(n + 2), threads(threads), barrier(threads),
+                                     frame_id(0), running(0), stop(false) {}
+};
+
+static void set_bnd(int b, float *x, int n)
+{
+    int s = n + 2;
+    for (int i = 1; i <= n; i++)
+    {
+        x[0 * s + i] = (b == 1) ? -x[1 * s + i] : x[1 * s + i];
+        x[(n + 1) * s + i] = (b == 1) ? -x[n * s + i] : x[n * s + i];
+        x[i * s + 0] = (b == 2) ? -x[i * s + 1] : x[i * s + 1];
+        x[i * s + n + 1] = (b == 2) ? -x[i * s + n] : x[i * s + n];
+    }
+
+    x[0] = 0.5f * (x[1 * s + 0] + x[0 * s + 1]);
+    x[n + 1] = 0.5f * (x[1 * s + n + 1] + x[0 * s + n]);
+    x[(n + 1) * s] = 0.5f * (x[n * s + 0] + x[(n + 1) * s + 1]);
+    x[(n + 1) * s + n + 1] = 0.5f * (x[n * s + n + 1] + x[(n + 1) * s + n]);
+}
+
+// The row passes below work on rows [i_begin, i_end) of one band. Inner loops
+// run over contiguous restrict pointers so the compiler vectorizes them.
+
+// One colour of a red-black sweep: cells with (i + j) & 1 == colour ^ 1
+// skipped, same update order as relax_rb in fluidsimulation_solver.h.
+static void relax_rb_rows(float *__restrict x, const float *__restrict x0, float a, float c,
+                          int colour, int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    for (int i = i_begin; i < i_end; i++)
+    {
+        float *__restrict row = x + i * s;
+        const float *__restrict up = x + (i - 1) * s;
+        const float *__restrict down = x + (i + 1) * s;
+        const float *__restrict src = x0 + i * s;
+        for (int j = 1 + ((i + colour) & 1); j <= n; j += 2)
+            row[j] = (src[j] + a * (up[j] + down[j] + row[j - 1] + row[j + 1])) / c;
+    }
+}
+
+static void divergence_rows(const float *__restrict u, const float *__restrict v,
+                            float *__restrict p, float *__restrict div_,
+                            int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    float fn = (float)n;
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float *__restrict u_up = u + (i - 1) * s;
+        const float *__restrict u_down = u + (i + 1) * s;
+        const float *__restrict v_row = v + i * s;
+        float *__restrict div_row = div_ + i * s;
+        float *__restrict p_row = p + i * s;
+        for (int j = 1; j <= n; j++)
+        {
+            div_row[j] = -0.5f * ((u_down[j] - u_up[j]) + (v_row[j + 1] - v_row[j - 1])) / fn;
+            p_row[j] = 0;
+        }
+    }
+}
+
+static void gradient_rows(float *__restrict u, float *__restrict v, const float *__restrict p,
+                          int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    float scale = 0.5f * n;
+    for (int i = i_begin; i < i_end; i++)
+    {
+        float *__restrict u_row = u + i * s;
+        float *__restrict v_row = v + i * s;
+        const float *__restrict p_up = p + (i - 1) * s;
+        const float *__restrict p_row = p + i * s;
+        const float *__restrict p_down = p + (i + 1) * s;
+        for (int j = 1; j <= n; j++)
+        {
+            u_row[j] -= scale * (p_down[j] - p_up[j]);
+            v_row[j] -= scale * (p_row[j + 1] - p_row[j - 1]);
+        }
+    }
+}
+
+#if HOST_FLUID_FORCES
+// Curl of the velocity, as vorticity() in fluidsimulation_solver.h
+static void vorticity_rows(const float *__restrict u, const float *__restrict v, float *__restrict curl,
+                           int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    float scale = 0.5f * n;
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float *__restrict u_row = u + i * s;
+        const float *__restrict v_up = v + (i - 1) * s;
+        const float *__restrict v_down = v + (i + 1) * s;
+        float *__restrict curl_row = curl + i * s;
+        for (int j = 1; j <= n; j++)
+            curl_row[j] = scale * ((v_down[j] - v_up[j]) - (u_row[j + 1] - u_row[j - 1]));
+    }
+}
+
+// Vorticity confinement and buoyancy, as apply_forces() in fluidsimulation_solver.h
+static void forces_rows(float *__restrict u, float *__restrict v, const float *__restrict curl,
+                        const float *__restrict dens, const float *__restrict temp,
+                        float dt, int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    float confine_scale = (float)(HOST_VORTICITY_EPS * dt / n);
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float *__restrict curl_up = curl + (i - 1) * s;
+        const float *__restrict curl_row = curl + i * s;
+        const float *__restrict curl_down = curl + (i + 1) * s;
+        for (int j = 1; j <= n; j++)
+        {
+            int k = i * s + j;
+            float gx = std::fabs(curl_down[j]) - std::fabs(curl_up[j]);
+            float gy = std::fabs(curl_row[j + 1]) - std::fabs(curl_row[j - 1]);
+            float length = std::sqrt(gx * gx + gy * gy) + 1e-5f;
+            float confine = confine_scale * curl_row[j];
+
+            u[k] += dt * ((float)HOST_BUOYANCY_BETA * (temp[k] - (float)HOST_AMBIENT_TEMPERATURE) -
+                          (float)HOST_BUOYANCY_ALPHA * dens[k]) +
+                    confine * (gy / length);
+            v[k] -= confine * (gx / length);
+        }
+    }
+}
+#endif
+
+// Backtrace and bilinear interpolation, as advect_backtrace /
+// advect_interpolate in fluidsimulation_solver.h
+static void advect_rows(float *d, const float *d0, const float *u, const float *v,
+                        float dt, int n, int i_begin, int i_end)
+{
+    int s = n + 2;
+    float dt0 = dt * n;
+    for (int i = i_begin; i < i_end; i++)
+    {
+        for (int j = 1; j <= n; j++)
+        {
+            float x = i - dt0 * u[i * s + j];
+            float y = j - dt0 * v[i * s + j];
+
+            if (x < 0.5)
+                x = 0.5;
+            if (x > n + 0.5)
+                x = n + 0.5;
+            if (y < 0.5)
+                y = 0.5;
+            if (y > n + 0.5)
+                y = n + 0.5;
+
+            int i0 = (int)x;
+            int i1 = i0 + 1;
+            int j0 = (int)y;
+            int j1 = j0 + 1;
+
+            float s1 = x - i0;
+            float s0 = 1 - s1;
+            float t1 = y - j0;
+            float t0 = 1 - t1;
+
+            i0 = std::min(std::max(i0, 0), n + 1);
+            i1 = std::min(std::max(i1, 0), n + 1);
+            j0 = std::min(std::max(j0, 0), n + 1);
+            j1 = std::min(std::max(j1, 0), n + 1);
+
+            d[i * s + j] = s0 * (t0 * d0[i0 * s + j0] + t1 * d0[i0 * s + j1]) +
+                           s1 * (t0 * d0[i1 * s + j0] + t1 * d0[i1 * s + j1]);
+        }
+    }
+}
+
+// Everything below runs on every thread at once. Each thread owns the band of
+// interior rows [i_begin, i_end); thread 0 also updates the boundary cells
+// between passes, with a barrier on either side.
+struct band
+{
+    fluid_host *fluid;
+    int id;
+    int i_begin, i_end;
+
+    void sync() { fluid->barrier.wait(); }
+
+    void boundary(int b, float *x)
+    {
+        sync();
+        if (id == 0)
+            set_bnd(b, x, fluid->n);
+        sync();
+    }
+
+    // Two fields of the same system solved side by side share the barriers
+    void lin_solve(int b0, float *x0, const float *src0, int b1, float *x1, const float *src1,
+                   float a, float c, int iters)
+    {
+        for (int k = 0; k < iters; k++)
+        {
+            for (int colour = 0; colour < 2; colour++)
+            {
+                relax_rb_rows(x0, src0, a, c, colour, fluid->n, i_begin, i_end);
+                if (x1)
+                    relax_rb_rows(x1, src1, a, c, colour, fluid->n, i_begin, i_end);
+                sync();
+            }
+            if (id == 0)
+            {
+                set_bnd(b0, x0, fluid->n);
+                if (x1)
+                    set_bnd(b1, x1, fluid->n);
+            }
+            sync();
+        }
+    }
+
+    void project(float *u, float *v, float *p, float *div_)
+    {
+        int n = fluid->n;
+        divergence_rows(u, v, p, div_, n, i_begin, i_end);
+        sync();
+        if (id == 0)
+        {
+            set_bnd(0, div_, n);
+            set_bnd(0, p, n);
+        }
+        sync();
+        lin_solve(0, p, div_, 0, nullptr, nullptr, 1, 4, HOST_PROJECT_ITERS);
+        gradient_rows(u, v, p, n, i_begin, i_end);
+        sync();
+        if (id == 0)
+        {
+            set_bnd(1, u, n);
+            set_bnd(2, v, n);
+        }
+        sync();
+    }
+
+    void step()
+    {
+        fluid_host &f = *fluid;
+        int n = f.n;
+
+        // Pointer swaps are repeated on every thread, so all of them see the
+        // same arrays without sharing the locals. The sources are already in
+        // the fields, the scratch arrays still hold the previous frame and
+        // seed the diffusion solve like the kernel's idle banks do.
+        float *u = f.u, *v = f.v, *u0 = f.u_prev, *v0 = f.v_prev;
+        float *x = f.dens, *x0 = f.dens_prev;
+        float *t = f.temp, *t0 = f.temp_prev;
+
+        // vel_step, forces first with the curl in div_
+#if HOST_FLUID_FORCES
+        vorticity_rows(u, v, f.div_, n, i_begin, i_end);
+        boundary(0, f.div_);
+        forces_rows(u, v, f.div_, x, t, f.dt, n, i_begin, i_end);
+        sync();
+        if (id == 0)
+        {
+            set_bnd(1, u, n);
+            set_bnd(2, v, n);
+        }
+        sync();
+#endif
+
+        std::swap(u, u0);
+        std::swap(v, v0);
+
+        float a = f.dt * f.visc * n * n;
+        lin_solve(1, u, u0, 2, v, v0, a, 1 + 4 * a, HOST_DIFFUSE_ITERS);
+        project(u, v, f.p, f.div_);
+        std::swap(u, u0);
+        std::swap(v, v0);
+
+        advect_rows(u, u0, u0, v0, f.dt, n, i_begin, i_end);
+        advect_rows(v, v0, u0, v0, f.dt, n, i_begin, i_end);
+        sync();
+        if (id == 0)
+        {
+            set_bnd(1, u, n);
+            set_bnd(2, v, n);
+        }
+        sync();
+        project(u, v, f.p, f.div_);
+
+        // dens_step
+        std::swap(x, x0);
+
+        a = f.dt * f.diff * n * n;
+        lin_solve(0, x, x0, 0, nullptr, nullptr, a, 1 + 4 * a, HOST_DIFFUSE_ITERS);
+        std::swap(x, x0);
+
+        advect_rows(x, x0, u, v, f.dt, n, i_begin, i_end);
+        boundary(0, x);
+
+#if HOST_FLUID_FORCES
+        // Temperature, carried along like the density
+        std::swap(t, t0);
+
+        lin_solve(0, t, t0, 0, nullptr, nullptr, a, 1 + 4 * a, HOST_DIFFUSE_ITERS);
+        std::swap(t, t0);
+
+        advect_rows(t, t0, u, v, f.dt, n, i_begin, i_end);
+        boundary(0, t);
+#endif
+
+        if (id == 0)
+        {
+            f.u = u;
+            f.v = v;
+            f.u_prev = u0;
+            f.v_prev = v0;
+            f.dens = x;
+            f.dens_prev = x0;
+            f.temp = t;
+            f.temp_prev = t0;
+        }
+    }
+};
+
+static band make_band(fluid_host *fluid, int id)
+{
+    band b;
+    b.fluid = fluid;
+    b.id = id;
+    b.i_begin = 1 + id * fluid->n / fluid->threads;
+    b.i_end = 1 + (id + 1) * fluid->n / fluid->threads;
+    return b;
+}
+
+static void worker(fluid_host *fluid, int id)
+{
+    band b = make_band(fluid, id);
+    int seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(fluid->mutex);
+            fluid->start_cv.wait(lock, [&] { return fluid->stop || fluid->frame_id != seen; });
+            if (fluid->stop)
+                return;
+            seen = fluid->frame_id;
+        }
+
+        b.step();
+
+        std::lock_guard<std::mutex> lock(fluid->mutex);
+        if (--fluid->running == 0)
+            fluid->done_cv.notify_one();
+    }
+}
+
+extern "C" fluid_host *fluid_host_create(int n, int threads, float dt, float diff, float visc)
+{
+    if (n < 2)
+        return nullptr;
+    // Every thread needs at least one row
+    threads = std::max(1, std::min(threads, n));
+
+    fluid_host *fluid = new fluid_host(n, threads);
+    fluid->dt = dt;
+    fluid->diff = diff;
+    fluid->visc = visc;
+
+    size_t size = (size_t)(n + 2) * (n + 2);
+    fluid->storage.assign(10 * size, 0.0f);
+    float *base = fluid->storage.data();
+    fluid->u = base + 0 * size;
+    fluid->v = base + 1 * size;
+    fluid->u_prev = base + 2 * size;
+    fluid->v_prev = base + 3 * size;
+    fluid->dens = base + 4 * size;
+    fluid->dens_prev = base + 5 * size;
+    fluid->p = base + 6 * size;
+    fluid->div_ = base + 7 * size;
+    fluid->temp = base + 8 * size;
+    fluid->temp_prev = base + 9 * size;
+
+    for (int id = 1; id < threads; id++)
+        fluid->workers.emplace_back(worker, fluid, id);
+
+    return fluid;
+}
+
+extern "C" void fluid_host_destroy(fluid_host *fluid)
+{
+    if (!fluid)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(fluid->mutex);
+        fluid->stop = true;
+    }
+    fluid->start_cv.notify_all();
+    for (std::thread &t : fluid->workers)
+        t.join();
+    delete fluid;
+}
+
+extern "C" void fluid_host_set_source(fluid_host *fluid, int i, int j, float dens, float u, float v, float temp)
+{
+    if (i < 1 || i > fluid->n || j < 1 || j > fluid->n)
+        return;
+    int k = i * fluid->stride + j;
+    fluid->dens[k] += fluid->dt * dens;
+    fluid->u[k] += fluid->dt * u;
+    fluid->v[k] += fluid->dt * v;
+#if HOST_FLUID_FORCES
+    fluid->temp[k] += fluid->dt * temp;
+#else
+    (void)temp;
+#endif
+}
+
+extern "C" void fluid_host_step(fluid_host *fluid)
+{
+    {
+        std::lock_guard<std::mutex> lock(fluid->mutex);
+        fluid->running = fluid->threads - 1;
+        fluid->frame_id++;
+    }
+    fluid->start_cv.notify_all();
+
+    // The calling thread takes band 0
+    make_band(fluid, 0).step();
+
+    std::unique_lock<std::mutex> lock(fluid->mutex);
+    fluid->done_cv.wait(lock, [&] { return fluid->running == 0; });
+}
+
+extern "C" const float *fluid_host_density(const fluid_host *fluid)
+{
+    return fluid->dens;
+}
+
+extern "C" const float *fluid_host_velocity_u(const fluid_host *fluid)
+{
+    return fluid->u;
+}
+
+extern "C" const float *fluid_host_velocity_v(const fluid_host *fluid)
+{
+    return fluid->v;
+}
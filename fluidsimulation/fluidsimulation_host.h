@@ -0,0 +1,47 @@
+#pragma once
+
+// Multithreaded CPU backend of the fluid simulation for the software path on
+// the ARM cores. Same vel_step / dens_step algorithm as the HLS kernel, with
+// red-black ordered solver sweeps so the grid can be split into row bands
+// that are updated in parallel. Run with float data_type and SOLVER_RED_BLACK
+// the kernel produces bit-identical results.
+//
+// Build as a shared library for fluidsimulation.py with
+//   g++ -O3 -ffp-contract=off -shared -fPIC -pthread fluidsimulation_host.cpp -o libfluidsimulation_host.so
+// -ffp-contract=off keeps the compiler from fusing multiply-adds, which would
+// break bit-exactness against the kernel.
+
+// Vorticity confinement and buoyancy, has to match FLUID_FORCES of the kernel
+// for the bit-exactness check in fluidsimulation_bench.cpp
+#ifndef HOST_FLUID_FORCES
+#define HOST_FLUID_FORCES 0
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct fluid_host fluid_host;
+
+    // n x n grid updated by the given number of threads (including the caller)
+    fluid_host *fluid_host_create(int n, int threads, float dt, float diff, float visc);
+    void fluid_host_destroy(fluid_host *fluid);
+
+    // Adds dt times the given source values to cell (i, j), 1 <= i, j <= n,
+    // like a kernel source record
+    void fluid_host_set_source(fluid_host *fluid, int i, int j, float dens, float u, float v, float temp);
+
+    // Advances one frame, vel_step followed by dens_step for the density and,
+    // with HOST_FLUID_FORCES, the temperature
+    void fluid_host_step(fluid_host *fluid);
+
+    // (n + 2) x (n + 2) row-major arrays including the boundary cells, valid
+    // until the next step
+    const float *fluid_host_density(const fluid_host *fluid);
+    const float *fluid_host_velocity_u(const fluid_host *fluid);
+    const float *fluid_host_velocity_v(const fluid_host *fluid);
+
+#ifdef __cplusplus
+}
+#endif
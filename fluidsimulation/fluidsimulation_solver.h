@@ -0,0 +1,1557 @@
+#pragma once
+
+// Fluid solver kernels, templated on the scalar type so the same code can be
+// synthesised with data_type and benchmarked with other types on the host.
+
+#include "fluidsimulation.h"
+
+#ifndef __SYNTHESIS__
+#include <chrono>
+#endif
+
+// Any square plane of S x S, the multigrid levels are smaller than MAX_SIZE
+template <typename T, int S>
+void set_bnd(int b, T x[S][S], int n)
+{
+#pragma HLS INLINE off
+set_bnd_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+        x[0][i] = (b == 1) ? T(-x[1][i]) : T(x[1][i]);
+        x[n + 1][i] = (b == 1) ? T(-x[n][i]) : T(x[n][i]);
+        x[i][0] = (b == 2) ? T(-x[i][1]) : T(x[i][1]);
+        x[i][n + 1] = (b == 2) ? T(-x[i][n]) : T(x[i][n]);
+    }
+
+    x[0][0] = T(0.5) * (x[1][0] + x[0][1]);
+    x[0][n + 1] = T(0.5) * (x[1][n + 1] + x[0][n]);
+    x[n + 1][0] = T(0.5) * (x[n][0] + x[n + 1][1]);
+    x[n + 1][n + 1] = T(0.5) * (x[n][n + 1] + x[n + 1][n]);
+}
+
+// Internal solid cells of the grid. Bit j of solid[i] is set for a solid cell
+// (i, j); obstacle_build() marks the outer ring solid too, it is the box wall.
+// Sweeps skip the lead[i] solid cells at the start and the trail[i]
+// at the end of row i, and jump over the gap_count[i] solid runs in between,
+// listed from gap[gap_first[i]] on as first | last << 16. Only the solid
+// cells next to fluid are ever read, they are listed in edge[] as
+// i | j << 16. A zeroed map is an open grid.
+struct obstacle_map
+{
+    ap_uint<MAX_SIZE> solid[MAX_SIZE];
+    int lead[MAX_SIZE];
+    int trail[MAX_SIZE];
+    int gap_first[MAX_SIZE];
+    int gap_count[MAX_SIZE];
+    int gap[MAX_N * MAX_N / 2];
+    int edge[MAX_N * MAX_N];
+    int edges;
+};
+
+inline void obstacle_clear(obstacle_map &obs)
+{
+#pragma HLS INLINE off
+obstacle_clear_loop:
+    for (int i = 0; i < MAX_SIZE; i++)
+    {
+#pragma HLS PIPELINE II = 1
+        obs.solid[i] = 0;
+        obs.lead[i] = 0;
+        obs.trail[i] = 0;
+        obs.gap_count[i] = 0;
+    }
+    obs.edges = 0;
+}
+
+// Walls in the outer ring, then the row spans, the gaps and the edge list
+// from solid[]
+inline void obstacle_build(obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+obstacle_ring_loop:
+    for (int i = 0; i <= n + 1; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+#pragma HLS PIPELINE II = 1
+        if (i == 0 || i == n + 1)
+        {
+            obs.solid[i] = ~ap_uint<MAX_SIZE>(0);
+        }
+        else
+        {
+            obs.solid[i][0] = 1;
+            obs.solid[i][n + 1] = 1;
+        }
+    }
+
+    obs.edges = 0;
+    int gaps = 0;
+obstacle_build_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+        ap_uint<MAX_SIZE> up = obs.solid[i - 1];
+        ap_uint<MAX_SIZE> row = obs.solid[i];
+        ap_uint<MAX_SIZE> down = obs.solid[i + 1];
+        int first = n + 1, last = 0;
+        int run = 0; // Start of the current solid run after the first fluid cell, 0 for none
+        obs.gap_first[i] = gaps;
+    obstacle_build_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            if (!row[j])
+            {
+                if (first > n)
+                    first = j;
+                if (run > 0)
+                    obs.gap[gaps++] = run | ((j - 1) << 16);
+                run = 0;
+                last = j;
+            }
+            else
+            {
+                if (first <= n && run == 0)
+                    run = j;
+                if (!up[j] || !down[j] || !row[j - 1] || !row[j + 1])
+                    obs.edge[obs.edges++] = i | (j << 16);
+            }
+        }
+        obs.lead[i] = first - 1;
+        obs.trail[i] = n - last;
+        obs.gap_count[i] = gaps - obs.gap_first[i];
+    }
+}
+
+// Walls around the solid cells next to fluid: the mean of their fluid
+// neighbours, with the velocity component normal to the face negated like
+// set_bnd() does at the box walls
+template <typename T>
+void obstacle_bnd(int b, T x[MAX_SIZE][MAX_SIZE], const obstacle_map &obs)
+{
+#pragma HLS INLINE off
+obstacle_bnd_loop:
+    for (int k = 0; k < obs.edges; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N * MAX_N
+#pragma HLS PIPELINE II = 4
+#pragma HLS DEPENDENCE variable = x inter false
+        int i = obs.edge[k] & 0xffff;
+        int j = obs.edge[k] >> 16;
+        T sum = 0;
+        int count = 0;
+        if (!obs.solid[i - 1][j])
+        {
+            sum += (b == 1) ? T(-x[i - 1][j]) : x[i - 1][j];
+            count++;
+        }
+        if (!obs.solid[i + 1][j])
+        {
+            sum += (b == 1) ? T(-x[i + 1][j]) : x[i + 1][j];
+            count++;
+        }
+        if (!obs.solid[i][j - 1])
+        {
+            sum += (b == 2) ? T(-x[i][j - 1]) : x[i][j - 1];
+            count++;
+        }
+        if (!obs.solid[i][j + 1])
+        {
+            sum += (b == 2) ? T(-x[i][j + 1]) : x[i][j + 1];
+            count++;
+        }
+        x[i][j] = (count == 1) ? sum : (count == 2) ? T(sum / 2) : (count == 3) ? T(sum / 3) : T(sum / 4);
+    }
+}
+
+template <typename T>
+void set_bnd(int b, T x[MAX_SIZE][MAX_SIZE], const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE
+    set_bnd(b, x, n);
+    obstacle_bnd(b, x, obs);
+}
+
+template <typename T>
+void relax_gs(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int iters,
+              const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+relax_gs_k_loop:
+    for (int k = 0; k < iters; k++)
+    {
+#pragma HLS PIPELINE off
+#pragma HLS LOOP_FLATTEN off
+    relax_gs_i_loop:
+        for (int i = 1; i <= n; i++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+#pragma HLS LOOP_FLATTEN off
+            int g = obs.gap_first[i];
+            int g_end = g + obs.gap_count[i];
+            int j = 1 + obs.lead[i];
+            int j_end = n - obs.trail[i];
+        relax_gs_j_loop:
+            while (j <= j_end)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+#pragma HLS LOOP_FLATTEN off
+                // A gap is always followed by a fluid cell
+                if (g < g_end && j == (obs.gap[g] & 0xffff))
+                {
+                    j = (obs.gap[g] >> 16) + 1;
+                    g++;
+                }
+                x[i][j] = (x0[i][j] + T(a) * (x[i - 1][j] + x[i + 1][j] + x[i][j - 1] + x[i][j + 1])) / T(c);
+                j++;
+            }
+        }
+        set_bnd(b, x, obs, n);
+    }
+}
+
+// Red-black (checkerboard) ordering: every cell of one colour only reads cells
+// of the other colour, so each half-sweep has no loop-carried dependency.
+// Jumping over a gap takes one iteration in place of its solid cells.
+template <typename T>
+void relax_rb(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int iters,
+              const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+relax_rb_k_loop:
+    for (int k = 0; k < iters; k++)
+    {
+#pragma HLS PIPELINE off
+    relax_rb_colour_loop:
+        for (int colour = 0; colour < 2; colour++)
+        {
+#pragma HLS PIPELINE off
+        relax_rb_i_loop:
+            for (int i = 1; i <= n; i++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+                int g = obs.gap_first[i];
+                int g_end = g + obs.gap_count[i];
+                int j = 1 + obs.lead[i];
+                int j_end = n - obs.trail[i];
+                // First cell of this colour in the span
+                j += (j + i + colour + 1) & 1;
+            relax_rb_j_loop:
+                while (j <= j_end)
+                {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2
+#pragma HLS PIPELINE II = 1
+#pragma HLS DEPENDENCE variable = x inter false
+                    if (g < g_end && j >= (obs.gap[g] & 0xffff))
+                    {
+                        // Next cell of this colour past the gap, which may
+                        // fall into the following gap
+                        int after = (obs.gap[g] >> 16) + 1;
+                        if (j < after)
+                            j = after + ((after - j) & 1);
+                        g++;
+                    }
+                    else
+                    {
+                        x[i][j] = (x0[i][j] + T(a) * (x[i - 1][j] + x[i + 1][j] + x[i][j - 1] + x[i][j + 1])) / T(c);
+                        j += 2;
+                    }
+                }
+            }
+        }
+        set_bnd(b, x, obs, n);
+    }
+}
+
+// Largest |x0 - (c * x - a * sum of neighbours)| / c over the fluid cells,
+// i.e. the largest change the next sweep would make.
+template <typename T>
+float residual_max(T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    T max_r = 0;
+residual_max_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    residual_max_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            T r = x0[i][j] - T(c) * x[i][j] + T(a) * (x[i - 1][j] + x[i + 1][j] + x[i][j - 1] + x[i][j + 1]);
+            if (r < 0)
+                r = -r;
+            if (!obs.solid[i][j] && r > max_r)
+                max_r = r;
+        }
+    }
+    return float(max_r) / c;
+}
+
+// The lin_solve_* functions run at most iters sweeps (V-cycles for multigrid).
+// With tol > 0 the residual is checked every RESIDUAL_CHECK_INTERVAL sweeps and
+// the solve stops once it is below tol. They return the sweeps actually run.
+template <typename T>
+int lin_solve_gs(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int iters, float tol,
+                 const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    int k = 0;
+lin_solve_gs_loop:
+    while (k < iters)
+    {
+        int sweeps = (iters - k < RESIDUAL_CHECK_INTERVAL) ? iters - k : RESIDUAL_CHECK_INTERVAL;
+        relax_gs(b, x, x0, a, c, sweeps, obs, n);
+        k += sweeps;
+        if (tol > 0 && residual_max(x, x0, a, c, obs, n) < tol)
+            break;
+    }
+    return k;
+}
+
+template <typename T>
+int lin_solve_rb(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int iters, float tol,
+                 const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    int k = 0;
+lin_solve_rb_loop:
+    while (k < iters)
+    {
+        int sweeps = (iters - k < RESIDUAL_CHECK_INTERVAL) ? iters - k : RESIDUAL_CHECK_INTERVAL;
+        relax_rb(b, x, x0, a, c, sweeps, obs, n);
+        k += sweeps;
+        if (tol > 0 && residual_max(x, x0, a, c, obs, n) < tol)
+            break;
+    }
+    return k;
+}
+
+// Geometric multigrid on the cell centred grid. Level l + 1 has (n + 1) / 2
+// cells per side, coarse cell I covering fine cells 2I - 1 and 2I. A coarse
+// cell is solid when all of its children are. The coarse levels have no edge
+// list, a fluid cell there treats its solid neighbours as mirrors of itself,
+// the zero gradient wall of the pressure.
+
+// Solid cells of the coarse level from those of the level below, the outer
+// ring is left to set_bnd()
+inline void mg_coarsen(ap_uint<MAX_SIZE> coarse[MAX_SIZE], const ap_uint<MAX_SIZE> fine[MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+    int nc = (n + 1) / 2;
+mg_coarsen_i_loop:
+    for (int i = 0; i <= nc + 1; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2 + 2
+        ap_uint<MAX_SIZE> row = 0;
+        int fi = (i >= 1 && i <= nc) ? 2 * i - 1 : 0;
+        ap_uint<MAX_SIZE> top = fine[fi];
+        ap_uint<MAX_SIZE> bottom = (fi + 1 <= n) ? fine[fi + 1] : top;
+    mg_coarsen_j_loop:
+        for (int j = 1; j <= nc; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2
+#pragma HLS PIPELINE II = 1
+            int fj = (2 * j <= n) ? 2 * j : 2 * j - 1;
+            row[j] = top[2 * j - 1] && top[fj] && bottom[2 * j - 1] && bottom[fj];
+        }
+        coarse[i] = (i >= 1 && i <= nc) ? row : ap_uint<MAX_SIZE>(0);
+    }
+}
+
+// Red-black sweeps of a coarse level. The solid neighbours of a fluid cell
+// drop out of the sum and out of the diagonal, solid cells are left alone.
+template <typename T, int S>
+void mg_relax(int b, T x[S][S], T x0[S][S], float a, float c, int iters, const ap_uint<MAX_SIZE> solid[MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+mg_relax_k_loop:
+    for (int k = 0; k < iters; k++)
+    {
+#pragma HLS PIPELINE off
+    mg_relax_colour_loop:
+        for (int colour = 0; colour < 2; colour++)
+        {
+#pragma HLS PIPELINE off
+        mg_relax_i_loop:
+            for (int i = 1; i <= n; i++)
+            {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2
+#pragma HLS PIPELINE off
+                ap_uint<MAX_SIZE> up = solid[i - 1];
+                ap_uint<MAX_SIZE> row = solid[i];
+                ap_uint<MAX_SIZE> down = solid[i + 1];
+                int j_begin = 1 + ((i + colour) & 1);
+            mg_relax_j_loop:
+                for (int jj = 0; jj < (n - j_begin + 2) / 2; jj++)
+                {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 4
+#pragma HLS PIPELINE II = 1
+#pragma HLS DEPENDENCE variable = x inter false
+                    int j = j_begin + 2 * jj;
+                    int walls = up[j] + down[j] + row[j - 1] + row[j + 1];
+                    T sum = (up[j] ? T(0) : x[i - 1][j]) + (down[j] ? T(0) : x[i + 1][j]) +
+                            (row[j - 1] ? T(0) : x[i][j - 1]) + (row[j + 1] ? T(0) : x[i][j + 1]);
+                    if (!row[j] && walls < 4)
+                        x[i][j] = (x0[i][j] + T(a) * sum) / (T(c) - T(a) * walls);
+                }
+            }
+        }
+        set_bnd(b, x, n);
+    }
+}
+
+// r = x0 - (c * x - a * sum of neighbours), zero in solid cells. COARSE uses
+// the operator of mg_relax, the finest level the one of relax_rb.
+template <typename T, bool COARSE, int S>
+void mg_residual(T r[MAX_SIZE][MAX_SIZE], T x[S][S], T x0[S][S], float a, float c, const ap_uint<MAX_SIZE> solid[MAX_SIZE],
+                 int n)
+{
+#pragma HLS INLINE off
+mg_residual_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+        ap_uint<MAX_SIZE> up = COARSE ? solid[i - 1] : ap_uint<MAX_SIZE>(0);
+        ap_uint<MAX_SIZE> row = solid[i];
+        ap_uint<MAX_SIZE> down = COARSE ? solid[i + 1] : ap_uint<MAX_SIZE>(0);
+    mg_residual_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            bool left = COARSE && row[j - 1], right = COARSE && row[j + 1];
+            int walls = up[j] + down[j] + left + right;
+            T sum = (up[j] ? T(0) : x[i - 1][j]) + (down[j] ? T(0) : x[i + 1][j]) + (left ? T(0) : x[i][j - 1]) +
+                    (right ? T(0) : x[i][j + 1]);
+            T residual = x0[i][j] - (T(c) - T(a) * walls) * x[i][j] + T(a) * sum;
+            r[i][j] = row[j] ? T(0) : residual;
+        }
+    }
+}
+
+// Average the fine residual of the (up to) four children into the coarse
+// right hand side and clear the coarse error.
+template <typename T, int SC>
+void mg_restrict(T bc[SC][SC], T xc[SC][SC], T r[MAX_SIZE][MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+    int nc = (n + 1) / 2;
+mg_restrict_i_loop:
+    for (int i = 0; i <= nc + 1; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2 + 2
+    mg_restrict_j_loop:
+        for (int j = 0; j <= nc + 1; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = (MAX_N + 1) / 2 + 2
+#pragma HLS PIPELINE II = 4
+            T sum = 0;
+            int count = 0;
+            if (i >= 1 && i <= nc && j >= 1 && j <= nc)
+            {
+            mg_restrict_child_loop:
+                for (int c = 0; c < 4; c++)
+                {
+                    int fi = 2 * i - 1 + (c >> 1);
+                    int fj = 2 * j - 1 + (c & 1);
+                    if (fi <= n && fj <= n)
+                    {
+                        sum += r[fi][fj];
+                        count++;
+                    }
+                }
+            }
+            bc[i][j] = (count == 4) ? T(sum / 4) : (count == 2) ? T(sum / 2) : sum;
+            xc[i][j] = 0;
+        }
+    }
+}
+
+// Bilinear interpolation of the coarse error, added to the fine solution.
+template <typename T, int SF, int SC>
+void mg_prolong(int b, T x[SF][SF], T xc[SC][SC], int n)
+{
+#pragma HLS INLINE off
+    set_bnd(b, xc, (n + 1) / 2);
+mg_prolong_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    mg_prolong_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            int ci = (i + 1) / 2;
+            int cj = (j + 1) / 2;
+            int ni = (i & 1) ? ci - 1 : ci + 1;
+            int nj = (j & 1) ? cj - 1 : cj + 1;
+            x[i][j] += (T(9) * xc[ci][cj] + T(3) * (xc[ni][cj] + xc[ci][nj]) + xc[ni][nj]) / 16;
+        }
+    }
+    set_bnd(b, x, n);
+}
+
+// The levels below the finest one, each with planes of its own largest grid
+// NC + 2 square. correct() restricts the residual r of the nf x nf grid
+// above into this level, solves for its error down to the coarsest level and
+// adds it, prolonged, to x of the grid above. a is the coupling of this
+// level, k = c - 4a of the finest one, solid[l - 1] its solid cells. Template
+// recursion, so every level gets arrays of its own size.
+template <typename T, int NC, int DEPTH>
+struct mg_level
+{
+    template <int SF>
+    static void correct(int b, T x[SF][SF], T r[MAX_SIZE][MAX_SIZE], float a, float k,
+                        const ap_uint<MAX_SIZE> solid[MG_LEVELS - 1][MAX_SIZE], int l, int nf)
+    {
+#pragma HLS INLINE off
+        static T xc[NC + 2][NC + 2];
+        static T bc[NC + 2][NC + 2];
+        int n = (nf + 1) / 2;
+
+        mg_restrict(bc, xc, r, nf);
+        mg_relax(b, xc, bc, a, k + 4 * a, MG_PRE_SMOOTH, solid[l - 1], n);
+        mg_residual<T, true>(r, xc, bc, a, k + 4 * a, solid[l - 1], n);
+        mg_level<T, (NC + 1) / 2, DEPTH - 1>::correct(b, xc, r, a / 4, k, solid, l + 1, n);
+        mg_relax(b, xc, bc, a, k + 4 * a, MG_POST_SMOOTH, solid[l - 1], n);
+        mg_prolong(b, x, xc, nf);
+    }
+};
+
+// The coarsest level, smoothed only
+template <typename T, int NC>
+struct mg_level<T, NC, 1>
+{
+    template <int SF>
+    static void correct(int b, T x[SF][SF], T r[MAX_SIZE][MAX_SIZE], float a, float k,
+                        const ap_uint<MAX_SIZE> solid[MG_LEVELS - 1][MAX_SIZE], int l, int nf)
+    {
+#pragma HLS INLINE off
+        static T xc[NC + 2][NC + 2];
+        static T bc[NC + 2][NC + 2];
+        int n = (nf + 1) / 2;
+
+        mg_restrict(bc, xc, r, nf);
+        mg_relax(b, xc, bc, a, k + 4 * a, MG_COARSE_SMOOTH, solid[l - 1], n);
+        mg_prolong(b, x, xc, nf);
+    }
+};
+
+// V-cycles for c * x - a * sum of neighbours = x0. With k = c - 4a the coarse
+// operator keeps k and divides a by four, which covers both the pressure
+// Poisson equation (k = 0) and implicit diffusion (k = 1).
+template <typename T>
+void mg_vcycle(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    // Residual of the level being restricted, in the top-left corner
+    static T mg_r[MAX_SIZE][MAX_SIZE];
+    // Solid cells of levels 1 and up
+    static ap_uint<MAX_SIZE> mg_solid[MG_LEVELS - 1][MAX_SIZE];
+
+    float k = c - 4 * a;
+
+    // About a third of a grid pass, cheaper than keeping track of obstacle updates
+    mg_coarsen(mg_solid[0], obs.solid, n);
+    int level_n = (n + 1) / 2;
+mg_vcycle_coarsen_loop:
+    for (int l = 1; l < MG_LEVELS - 1; l++)
+    {
+        mg_coarsen(mg_solid[l], mg_solid[l - 1], level_n);
+        level_n = (level_n + 1) / 2;
+    }
+
+    relax_rb(b, x, x0, a, c, MG_PRE_SMOOTH, obs, n);
+    mg_residual<T, false>(mg_r, x, x0, a, c, obs.solid, n);
+    mg_level<T, (MAX_N + 1) / 2, MG_LEVELS - 1>::correct(b, x, mg_r, a / 4, k, mg_solid, 1, n);
+    relax_rb(b, x, x0, a, c, MG_POST_SMOOTH, obs, n);
+}
+
+template <typename T>
+int lin_solve_mg(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int cycles, float tol,
+                 const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    int k = 0;
+lin_solve_mg_cycle_loop:
+    while (k < cycles)
+    {
+        mg_vcycle(b, x, x0, a, c, obs, n);
+        k++;
+        if (tol > 0 && residual_max(x, x0, a, c, obs, n) < tol)
+            break;
+    }
+    return k;
+}
+
+template <typename T>
+int lin_solve(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float a, float c, int iters, float tol,
+              const obstacle_map &obs, int n)
+{
+#if SOLVER == SOLVER_MULTIGRID
+    return lin_solve_mg<T>(b, x, x0, a, c, MG_CYCLES, tol, obs, n);
+#elif SOLVER == SOLVER_RED_BLACK
+    return lin_solve_rb<T>(b, x, x0, a, c, iters, tol, obs, n);
+#else
+    return lin_solve_gs<T>(b, x, x0, a, c, iters, tol, obs, n);
+#endif
+}
+
+template <typename T>
+int diffuse(int b, T x[MAX_SIZE][MAX_SIZE], T x0[MAX_SIZE][MAX_SIZE], float diff, float dt, float tol,
+            const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    float a = dt * diff * n * n;
+    return lin_solve(b, x, x0, a, 1 + 4 * a, DIFFUSE_ITERS, tol, obs, n);
+}
+
+// Bilinear taps of the semi-Lagrangian backtrace from cell (i, j)
+struct advect_taps
+{
+    int i0, i1, j0, j1;
+    float s0, s1, t0, t1;
+};
+
+template <typename T>
+advect_taps advect_backtrace(int i, int j, T uij, T vij, float dt0, int n)
+{
+#pragma HLS INLINE
+    float x = i - T(dt0) * uij;
+    float y = j - T(dt0) * vij;
+
+    if (x < 0.5)
+        x = 0.5;
+    if (x > n + 0.5)
+        x = n + 0.5;
+    if (y < 0.5)
+        y = 0.5;
+    if (y > n + 0.5)
+        y = n + 0.5;
+
+    advect_taps t;
+    t.i0 = (int)x;
+    t.i1 = t.i0 + 1;
+    t.j0 = (int)y;
+    t.j1 = t.j0 + 1;
+
+    t.s1 = x - t.i0;
+    t.s0 = 1 - t.s1;
+    t.t1 = y - t.j0;
+    t.t0 = 1 - t.t1;
+
+    // clamp indices
+    if (t.i0 < 0)
+        t.i0 = 0;
+    if (t.i0 > n + 1)
+        t.i0 = n + 1;
+    if (t.i1 < 0)
+        t.i1 = 0;
+    if (t.i1 > n + 1)
+        t.i1 = n + 1;
+    if (t.j0 < 0)
+        t.j0 = 0;
+    if (t.j0 > n + 1)
+        t.j0 = n + 1;
+    if (t.j1 < 0)
+        t.j1 = 0;
+    if (t.j1 > n + 1)
+        t.j1 = n + 1;
+
+    return t;
+}
+
+template <typename T>
+T advect_interpolate(T d0[MAX_SIZE][MAX_SIZE], const advect_taps &t)
+{
+#pragma HLS INLINE
+    return T(t.s0) * (T(t.t0) * d0[t.i0][t.j0] + T(t.t1) * d0[t.i0][t.j1]) +
+           T(t.s1) * (T(t.t0) * d0[t.i1][t.j0] + T(t.t1) * d0[t.i1][t.j1]);
+}
+
+template <typename T>
+void advect_direct(int b, T d[MAX_SIZE][MAX_SIZE], T d0[MAX_SIZE][MAX_SIZE],
+                   T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE off
+    float dt0 = dt * n;
+advect_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+    advect_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+            advect_taps t = advect_backtrace(i, j, u[i][j], v[i][j], dt0, n);
+            d[i][j] = advect_interpolate(d0, t);
+        }
+    }
+    set_bnd(b, d, n);
+}
+
+template <typename T>
+void divergence(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+    project_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS UNROLL off
+#pragma HLS PIPELINE off
+        project_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS UNROLL off
+#pragma HLS PIPELINE off
+            div_[i][j] = T(-0.5) * ((u[i + 1][j] - u[i - 1][j]) + (v[i][j + 1] - v[i][j - 1])) / n;
+            p[i][j] = 0;
+        }
+    }
+}
+
+// Solves for the pressure of the divergence in div_ and subtracts its gradient
+// from the velocity. Expects p cleared by the divergence pass.
+template <typename T>
+int pressure_correct(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                     T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], float tol, const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    set_bnd(0, div_, n);
+    set_bnd(0, p, obs, n);
+
+    // The gradient step scales p by n, so compare its residual in velocity units
+    int iters = lin_solve(0, p, div_, 1, 4, PROJECT_ITERS, tol / n, obs, n);
+
+    project_i2_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+#pragma HLS UNROLL off
+        project_j2_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+#pragma HLS UNROLL off
+            u[i][j] -= T(0.5) * n * (p[i + 1][j] - p[i - 1][j]);
+            v[i][j] -= T(0.5) * n * (p[i][j + 1] - p[i][j - 1]);
+        }
+    }
+    set_bnd(1, u, obs, n);
+    set_bnd(2, v, obs, n);
+
+    return iters;
+}
+
+template <typename T>
+int project(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+            T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], float tol, const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    divergence(u, v, p, div_, n);
+    return pressure_correct(u, v, p, div_, tol, obs, n);
+}
+
+template <typename T>
+struct velocity_sample
+{
+    T u;
+    T v;
+};
+
+// Taps of the fixed-point backtrace. i1 = i0 + 1 and j1 = j0 + 1 always, so
+// the four taps fall into the four row / column parity banks.
+struct window_taps
+{
+    int i0, j0;
+    coord_type s1, t1;
+};
+
+template <typename T>
+window_taps window_backtrace(int i, int j, T uij, T vij, coord_type dt0, int n)
+{
+#pragma HLS INLINE
+    // Saturated, a wrapped velocity or product would flip the clamp below
+    displacement_type dx = dt0 * displacement_type(uij);
+    displacement_type dy = dt0 * displacement_type(vij);
+
+    // Bounded displacement, the window only reaches this far
+    if (dx > ADVECT_MAX_DISPLACEMENT)
+        dx = ADVECT_MAX_DISPLACEMENT;
+    if (dx < -ADVECT_MAX_DISPLACEMENT)
+        dx = -ADVECT_MAX_DISPLACEMENT;
+    if (dy > ADVECT_MAX_DISPLACEMENT)
+        dy = ADVECT_MAX_DISPLACEMENT;
+    if (dy < -ADVECT_MAX_DISPLACEMENT)
+        dy = -ADVECT_MAX_DISPLACEMENT;
+
+    coord_type x = i - dx;
+    coord_type y = j - dy;
+
+    if (x < coord_type(0.5))
+        x = 0.5;
+    if (x > coord_type(n + 0.5))
+        x = n + 0.5;
+    if (y < coord_type(0.5))
+        y = 0.5;
+    if (y > coord_type(n + 0.5))
+        y = n + 0.5;
+
+    window_taps t;
+    t.i0 = x.to_int();
+    t.j0 = y.to_int();
+    t.s1 = x - t.i0;
+    t.t1 = y - t.j0;
+    return t;
+}
+
+// Rows of d0 around the row being advected, split into four banks by row and
+// column parity so one cycle can read all four bilinear taps. The window row
+// count is even, so a row keeps its parity in the window.
+template <typename T>
+struct advect_window
+{
+    T bank[2][2][ADVECT_WINDOW_ROWS / 2][MAX_SIZE / 2 + 1];
+};
+
+template <typename T>
+void window_store(advect_window<T> &w, int r, int c, T value)
+{
+#pragma HLS INLINE
+    w.bank[r & 1][c & 1][(r % ADVECT_WINDOW_ROWS) / 2][c / 2] = value;
+}
+
+template <typename T>
+T window_gather(advect_window<T> &w, const window_taps &t)
+{
+#pragma HLS INLINE
+    int i1 = t.i0 + 1;
+    int j1 = t.j0 + 1;
+
+    // Every bank is read exactly once
+    T tap[2][2];
+#pragma HLS ARRAY_PARTITION variable = tap complete dim = 0
+window_gather_row_loop:
+    for (int pi = 0; pi < 2; pi++)
+    {
+#pragma HLS UNROLL
+    window_gather_col_loop:
+        for (int pj = 0; pj < 2; pj++)
+        {
+#pragma HLS UNROLL
+            int r = ((t.i0 & 1) == pi) ? t.i0 : i1;
+            int c = ((t.j0 & 1) == pj) ? t.j0 : j1;
+            tap[pi][pj] = w.bank[pi][pj][(r % ADVECT_WINDOW_ROWS) / 2][c / 2];
+        }
+    }
+
+    T s1 = t.s1;
+    T s0 = T(1) - s1;
+    T t1 = t.t1;
+    T t0 = T(1) - t1;
+    return s0 * (t0 * tap[t.i0 & 1][t.j0 & 1] + t1 * tap[t.i0 & 1][j1 & 1]) +
+           s1 * (t0 * tap[i1 & 1][t.j0 & 1] + t1 * tap[i1 & 1][j1 & 1]);
+}
+
+// Window engine: streams the advection of FIELDS (1 or 2) fields row by row,
+// the first field in .u and the second one in .v of each sample. Row r of the
+// fields enters the window while row r - ADVECT_MAX_DISPLACEMENT - 2 is
+// advected, so d0 is read once, in order, and the loop pipelines at II=1.
+template <typename T, int FIELDS>
+void advect_window_stream(T a0[MAX_SIZE][MAX_SIZE], T b0[MAX_SIZE][MAX_SIZE],
+                          T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                          hls::stream<velocity_sample<T> > &advected, float dt, int n)
+{
+#pragma HLS INLINE off
+    advect_window<T> wa, wb;
+#pragma HLS ARRAY_PARTITION variable = wa.bank complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = wa.bank complete dim = 2
+#pragma HLS ARRAY_PARTITION variable = wb.bank complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = wb.bank complete dim = 2
+
+    const int lag = ADVECT_MAX_DISPLACEMENT + 2;
+    coord_type dt0 = dt * n;
+
+window_r_loop:
+    for (int r = 0; r <= n + 1 + lag; r++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE + ADVECT_MAX_DISPLACEMENT + 2
+        int i = r - lag;
+    window_j_loop:
+        for (int j = 0; j <= n + 1; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SIZE
+#pragma HLS PIPELINE II = 1
+#pragma HLS DEPENDENCE variable = wa.bank inter false
+#pragma HLS DEPENDENCE variable = wb.bank inter false
+            if (r <= n + 1)
+            {
+                window_store(wa, r, j, a0[r][j]);
+                if (FIELDS == 2)
+                    window_store(wb, r, j, b0[r][j]);
+            }
+
+            if (i >= 1 && i <= n && j >= 1 && j <= n)
+            {
+                window_taps t = window_backtrace(i, j, u[i][j], v[i][j], dt0, n);
+                velocity_sample<T> s;
+                s.u = window_gather(wa, t);
+                s.v = (FIELDS == 2) ? window_gather(wb, t) : T(0);
+                advected.write(s);
+            }
+        }
+    }
+}
+
+template <typename T>
+void advect_store_stream(hls::stream<velocity_sample<T> > &advected, T d[MAX_SIZE][MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+advect_store_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    advect_store_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            d[i][j] = advected.read().u;
+        }
+    }
+}
+
+// advect() on the window engine
+template <typename T>
+void advect_window_field(int b, T d[MAX_SIZE][MAX_SIZE], T d0[MAX_SIZE][MAX_SIZE],
+                         T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE off
+    {
+#pragma HLS DATAFLOW
+        hls::stream<velocity_sample<T> > advected("advected");
+#pragma HLS STREAM variable = advected depth = 4
+        advect_window_stream<T, 1>(d0, d0, u, v, advected, dt, n);
+        advect_store_stream(advected, d, n);
+    }
+    set_bnd(b, d, n);
+}
+
+template <typename T>
+void advect(int b, T d[MAX_SIZE][MAX_SIZE], T d0[MAX_SIZE][MAX_SIZE],
+            T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE
+#if ADVECT_ENGINE == ADVECT_ENGINE_WINDOW
+    advect_window_field(b, d, d0, u, v, dt, n);
+#else
+    advect_direct(b, d, d0, u, v, dt, n);
+#endif
+}
+
+
+// MacCormack: the semi-Lagrangian result is advected back with -dt, half the
+// round trip error is added as a correction and the result is limited to the
+// four d0 taps of the forward backtrace, so no new extrema appear. Costs two
+// advect() passes plus the correction pass; tmp is scratch.
+template <typename T>
+void advect_maccormack(int b, T d[MAX_SIZE][MAX_SIZE], T d0[MAX_SIZE][MAX_SIZE],
+                       T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                       T tmp[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE off
+    advect(b, d, d0, u, v, dt, n);
+    advect(b, tmp, d, u, v, -dt, n);
+
+    float dt0 = dt * n;
+maccormack_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    maccormack_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE off
+            advect_taps t = advect_backtrace(i, j, u[i][j], v[i][j], dt0, n);
+            T d00 = d0[t.i0][t.j0];
+            T d01 = d0[t.i0][t.j1];
+            T d10 = d0[t.i1][t.j0];
+            T d11 = d0[t.i1][t.j1];
+            T lo = d00 < d01 ? d00 : d01;
+            lo = d10 < lo ? d10 : lo;
+            lo = d11 < lo ? d11 : lo;
+            T hi = d00 > d01 ? d00 : d01;
+            hi = d10 > hi ? d10 : hi;
+            hi = d11 > hi ? d11 : hi;
+
+            T value = d[i][j] + T(0.5) * (d0[i][j] - tmp[i][j]);
+            if (value < lo)
+                value = lo;
+            if (value > hi)
+                value = hi;
+            d[i][j] = value;
+        }
+    }
+    set_bnd(b, d, n);
+}
+
+// advect() with the scheme selected by ADVECT_SCHEME
+template <typename T>
+void advect_field(int b, T d[MAX_SIZE][MAX_SIZE], T d0[MAX_SIZE][MAX_SIZE],
+                  T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                  T tmp[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE
+#if ADVECT_SCHEME == ADVECT_MACCORMACK
+    advect_maccormack(b, d, d0, u, v, tmp, dt, n);
+#else
+    (void)tmp;
+    advect(b, d, d0, u, v, dt, n);
+#endif
+}
+
+// Dataflow producer: semi-Lagrangian advection of both velocity components,
+// emitted row by row.
+template <typename T>
+void advect_velocity_stream(T u0[MAX_SIZE][MAX_SIZE], T v0[MAX_SIZE][MAX_SIZE],
+                            hls::stream<velocity_sample<T> > &advected, float dt, int n)
+{
+#pragma HLS INLINE off
+    float dt0 = dt * n;
+advect_velocity_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    advect_velocity_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            advect_taps t = advect_backtrace(i, j, u0[i][j], v0[i][j], dt0, n);
+            velocity_sample<T> s;
+            s.u = advect_interpolate(u0, t);
+            s.v = advect_interpolate(v0, t);
+            advected.write(s);
+        }
+    }
+}
+
+// Dataflow consumer: stores the advected velocity and computes the divergence
+// of row i - 1 while row i arrives. Two rows of u and one row of v are kept in
+// line buffers; the wall values set_bnd would write are mirrored in place.
+template <typename T>
+void divergence_stream(hls::stream<velocity_sample<T> > &advected,
+                       T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                       T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+    T u_line_1[MAX_SIZE]; // u of row i - 1
+    T u_line_2[MAX_SIZE]; // u of row i - 2
+    T v_line_1[MAX_SIZE]; // v of row i - 1
+
+divergence_stream_i_loop:
+    for (int i = 1; i <= n + 1; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N + 1
+        T v_left = 0;
+    divergence_stream_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            velocity_sample<T> s;
+            s.u = 0;
+            s.v = 0;
+            if (i <= n)
+            {
+                advected.read(s);
+                u[i][j] = s.u;
+                v[i][j] = s.v;
+            }
+
+            T v_centre = v_line_1[j];
+            if (i >= 2)
+            {
+                int r = i - 1;
+                T u_down = (r == 1) ? T(-u_line_1[j]) : u_line_2[j];
+                T u_up = (r == n) ? T(-u_line_1[j]) : s.u;
+                T v_l = (j == 1) ? T(-v_centre) : v_left;
+                T v_r = (j == n) ? T(-v_centre) : v_line_1[j + 1];
+                div_[r][j] = T(-0.5) * ((u_up - u_down) + (v_r - v_l)) / n;
+                p[r][j] = 0;
+            }
+            v_left = v_centre;
+
+            u_line_2[j] = u_line_1[j];
+            u_line_1[j] = s.u;
+            v_line_1[j] = s.v;
+        }
+    }
+}
+
+// Advection of the velocity fused with the divergence pass of the following
+// projection. Gives the same result as advect() on both components followed by
+// divergence(); the walls of u and v are rewritten by pressure_correct().
+template <typename T>
+void advect_divergence(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE],
+                       T u0[MAX_SIZE][MAX_SIZE], T v0[MAX_SIZE][MAX_SIZE],
+                       T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], float dt, int n)
+{
+#pragma HLS INLINE off
+#pragma HLS DATAFLOW
+    hls::stream<velocity_sample<T> > advected("advected");
+#pragma HLS STREAM variable = advected depth = 4
+
+#if ADVECT_ENGINE == ADVECT_ENGINE_WINDOW
+    advect_window_stream<T, 2>(u0, v0, u0, v0, advected, dt, n);
+#else
+    advect_velocity_stream(u0, v0, advected, dt, n);
+#endif
+    divergence_stream(advected, u, v, p, div_, n);
+}
+
+// Curl of the velocity, dv/dx - du/dy, with the walls mirrored so the
+// confinement pass can take its gradient right up to them
+template <typename T>
+void vorticity(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], T curl[MAX_SIZE][MAX_SIZE], int n)
+{
+#pragma HLS INLINE off
+vorticity_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    vorticity_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            curl[i][j] = T(0.5) * n * ((v[i + 1][j] - v[i - 1][j]) - (u[i][j + 1] - u[i][j - 1]));
+        }
+    }
+    set_bnd(0, curl, n);
+}
+
+// Adds the confinement force eps * h * (N x curl), N the unit gradient of
+// |curl|, and the buoyancy of dens and temp to the velocity in place
+template <typename T>
+void apply_forces(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], T curl[MAX_SIZE][MAX_SIZE],
+                  T dens[MAX_SIZE][MAX_SIZE], T temp[MAX_SIZE][MAX_SIZE], float dt, const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+    T confine_scale = T(VORTICITY_EPS * dt / n);
+forces_i_loop:
+    for (int i = 1; i <= n; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+    forces_j_loop:
+        for (int j = 1; j <= n; j++)
+        {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N
+#pragma HLS PIPELINE II = 1
+            // The central difference factor cancels in the normalisation
+            float gx = hls::fabs(float(curl[i + 1][j])) - hls::fabs(float(curl[i - 1][j]));
+            float gy = hls::fabs(float(curl[i][j + 1])) - hls::fabs(float(curl[i][j - 1]));
+            float length = hls::sqrt(gx * gx + gy * gy) + 1e-5f;
+            T confine = confine_scale * curl[i][j];
+
+            u[i][j] += T(dt) * (T(BUOYANCY_BETA) * (temp[i][j] - T(AMBIENT_TEMPERATURE)) - T(BUOYANCY_ALPHA) * dens[i][j]) +
+                       confine * T(gy / length);
+            v[i][j] -= confine * T(gx / length);
+        }
+    }
+    set_bnd(1, u, obs, n);
+    set_bnd(2, v, obs, n);
+}
+
+// Cycles each stage took, sampled from the free-running counter that
+// fluidsimulation_cycle_counter drives next to the kernel. profile_begin and
+// profile_end latch it at the stage boundaries. The counter is a plain
+// volatile port that shares no data with the stages, so both reads are tied
+// to their stage by data: profile_begin passes a value through its read that
+// the stage then takes as an argument, and profile_end only reads once a
+// token the stage produced is there, a count it returned or profile_token().
+// No counter runs alongside the C simulation, there the clock is steady_clock
+// in nanoseconds.
+struct stage_profile
+{
+    long long cycles[STAGE_COUNT];
+    long long start;
+};
+
+inline void profile_clear(stage_profile &prof)
+{
+profile_clear_loop:
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        prof.cycles[stage] = 0;
+}
+
+#ifdef __SYNTHESIS__
+inline long long profile_now(const volatile long long &clock)
+{
+    return clock;
+}
+#else
+inline long long profile_now(const volatile long long &)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#endif
+
+// Returns value once the clock has been read, hand it to the stage so the
+// stage cannot start before the read
+inline int profile_begin(stage_profile &prof, const volatile long long &clock, int value)
+{
+    prof.start = profile_now(clock);
+    return prof.start >= 0 ? value : 0;
+}
+
+// token is a value >= 0 the stage produced, the clock is only read once the
+// stage has delivered it
+inline void profile_end(stage_profile &prof, const volatile long long &clock, int stage, int token)
+{
+    if (token >= 0)
+        prof.cycles[stage] += profile_now(clock) - prof.start;
+}
+
+// value >= 0 as a token that is only there once the stage wrote x, for stages
+// that return nothing
+template <typename T>
+int profile_token(T x[MAX_SIZE][MAX_SIZE], int value)
+{
+#pragma HLS INLINE
+    return x[1][1] == T(0) ? value : value + 1;
+}
+
+// The fused divergence pass reads the solid cells before their walls are
+// set, redo the divergence of the fluid cells next to them
+template <typename T>
+void obstacle_divergence(T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE],
+                         const obstacle_map &obs, int n)
+{
+#pragma HLS INLINE off
+obstacle_divergence_loop:
+    for (int k = 0; k < obs.edges; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_N * MAX_N
+    obstacle_divergence_side_loop:
+        for (int side = 0; side < 4; side++)
+        {
+#pragma HLS PIPELINE II = 4
+            int i = (obs.edge[k] & 0xffff) + ((side == 0) ? -1 : (side == 1) ? 1 : 0);
+            int j = (obs.edge[k] >> 16) + ((side == 2) ? -1 : (side == 3) ? 1 : 0);
+            if (!obs.solid[i][j])
+                div_[i][j] = T(-0.5) * ((u[i + 1][j] - u[i - 1][j]) + (v[i][j + 1] - v[i][j - 1])) / n;
+        }
+    }
+}
+
+// u[bank] / v[bank] hold the velocity with this frame's sources already
+// added, u[!bank] / v[!bank] are scratch. dens and temp drive the buoyancy.
+// FUSED streams the advection into the divergence pass, see
+// FUSED_ADVECT_PROJECT.
+template <typename T, bool FUSED = FUSED_ADVECT_PROJECT>
+int vel_step(T u[2][MAX_SIZE][MAX_SIZE], T v[2][MAX_SIZE][MAX_SIZE], bool &bank,
+             T dens[MAX_SIZE][MAX_SIZE], T temp[MAX_SIZE][MAX_SIZE],
+             T p[MAX_SIZE][MAX_SIZE], T div_[MAX_SIZE][MAX_SIZE], T tmp[MAX_SIZE][MAX_SIZE],
+             float visc, float dt, float tol, const obstacle_map &obs, stage_profile &prof,
+             const volatile long long &clock, int n)
+{
+#pragma HLS INLINE off
+    int iters = 0;
+    int sweeps;
+
+#if FLUID_FORCES
+    // div_ is rewritten by the projection, it holds the curl until then
+    int forces_n = profile_begin(prof, clock, n);
+    vorticity(u[bank], v[bank], div_, forces_n);
+    apply_forces(u[bank], v[bank], div_, dens, temp, dt, obs, forces_n);
+    profile_end(prof, clock, STAGE_FORCES, profile_token(v[bank], n));
+#else
+    (void)dens;
+    (void)temp;
+#endif
+
+    bank = !bank;
+
+    int diffuse_n = profile_begin(prof, clock, n);
+    sweeps = diffuse(1, u[bank], u[!bank], visc, dt, tol, obs, diffuse_n);
+    sweeps += diffuse(2, v[bank], v[!bank], visc, dt, tol, obs, diffuse_n);
+    profile_end(prof, clock, STAGE_DIFFUSE, sweeps);
+    iters += sweeps;
+
+    int project_n = profile_begin(prof, clock, n);
+    sweeps = project(u[bank], v[bank], p, div_, tol, obs, project_n);
+    profile_end(prof, clock, STAGE_PROJECT, sweeps);
+    iters += sweeps;
+
+    bank = !bank;
+
+    if (FUSED)
+    {
+        // The divergence pass rides along with the advection
+        int advect_n = profile_begin(prof, clock, n);
+        advect_divergence(u[bank], v[bank], u[!bank], v[!bank], p, div_, dt, advect_n);
+        if (obs.edges > 0)
+        {
+            set_bnd(1, u[bank], obs, advect_n);
+            set_bnd(2, v[bank], obs, advect_n);
+            obstacle_divergence(u[bank], v[bank], div_, obs, advect_n);
+        }
+        profile_end(prof, clock, STAGE_ADVECT, profile_token(div_, n));
+
+        int correct_n = profile_begin(prof, clock, n);
+        sweeps = pressure_correct(u[bank], v[bank], p, div_, tol, obs, correct_n);
+        profile_end(prof, clock, STAGE_PROJECT, sweeps);
+        iters += sweeps;
+    }
+    else
+    {
+        int advect_n = profile_begin(prof, clock, n);
+        advect_field(1, u[bank], u[!bank], u[!bank], v[!bank], tmp, dt, advect_n);
+        advect_field(2, v[bank], v[!bank], u[!bank], v[!bank], tmp, dt, advect_n);
+        obstacle_bnd(1, u[bank], obs);
+        obstacle_bnd(2, v[bank], obs);
+        profile_end(prof, clock, STAGE_ADVECT, profile_token(v[bank], n));
+
+        int project_n = profile_begin(prof, clock, n);
+        sweeps = project(u[bank], v[bank], p, div_, tol, obs, project_n);
+        profile_end(prof, clock, STAGE_PROJECT, sweeps);
+        iters += sweeps;
+    }
+
+    return iters;
+}
+
+// x[bank] holds the density with this frame's sources already added,
+// x[!bank] is scratch.
+template <typename T>
+int dens_step(T x[2][MAX_SIZE][MAX_SIZE], bool &bank,
+              T u[MAX_SIZE][MAX_SIZE], T v[MAX_SIZE][MAX_SIZE], T tmp[MAX_SIZE][MAX_SIZE],
+              float diff, float dt, float tol, const obstacle_map &obs, stage_profile &prof,
+              const volatile long long &clock, int n)
+{
+#pragma HLS INLINE off
+    bank = !bank;
+
+    int diffuse_n = profile_begin(prof, clock, n);
+    int iters = diffuse(0, x[bank], x[!bank], diff, dt, tol, obs, diffuse_n);
+    profile_end(prof, clock, STAGE_DIFFUSE, iters);
+
+    bank = !bank;
+
+    int advect_n = profile_begin(prof, clock, n);
+    advect_field(0, x[bank], x[!bank], u, v, tmp, dt, advect_n);
+    obstacle_bnd(0, x[bank], obs);
+    profile_end(prof, clock, STAGE_ADVECT, profile_token(x[bank], n));
+
+    return iters;
+}
+
+// Source records carry each scalar as a raw 32-bit word, the bits of a fixed
+// point value or the IEEE word of a float, so both data_type choices build
+template <int W, int I, ap_q_mode Q, ap_o_mode O, int N>
+int scalar_to_bits(ap_fixed<W, I, Q, O, N> value)
+{
+#pragma HLS INLINE
+    return value.range();
+}
+
+template <int W, int I, ap_q_mode Q, ap_o_mode O, int N>
+void scalar_from_bits(int bits, ap_fixed<W, I, Q, O, N> &value)
+{
+#pragma HLS INLINE
+    value.range() = bits;
+}
+
+static inline int scalar_to_bits(float value)
+{
+#pragma HLS INLINE
+    union
+    {
+        float f;
+        int i;
+    } bits;
+    bits.f = value;
+    return bits.i;
+}
+
+static inline void scalar_from_bits(int bits, float &value)
+{
+#pragma HLS INLINE
+    union
+    {
+        float f;
+        int i;
+    } word;
+    word.i = bits;
+    value = word.f;
+}
+
+// Tag of the scalar type in checkpoints, which hold the same raw words.
+// Fixed point types give width | integer bits << 8, float gives 32 | 1 << 16.
+template <int W, int I, ap_q_mode Q, ap_o_mode O, int N>
+int scalar_type_tag(ap_fixed<W, I, Q, O, N>)
+{
+#pragma HLS INLINE
+    return W | (I << 8);
+}
+
+static inline int scalar_type_tag(float)
+{
+#pragma HLS INLINE
+    return 32 | (1 << 16);
+}
+
+// Source record: adds dt times dens, u, v and temp at cell (x, y). Cells
+// outside the grid or solid are ignored.
+template <typename T>
+struct fluid_source
+{
+    int x, y;
+    T dens, u, v, temp;
+};
+
+// Complete simulation state of one grid
+template <typename T>
+struct fluid_state
+{
+    // Each field and its source / scratch array share a two bank buffer. The
+    // bank select bit says which bank holds the field, so swapping the two is
+    // a single bit flip instead of a copy.
+    T u[2][MAX_SIZE][MAX_SIZE];
+    T v[2][MAX_SIZE][MAX_SIZE];
+    T dens[2][MAX_SIZE][MAX_SIZE];
+    T temp[2][MAX_SIZE][MAX_SIZE]; // Carried along like the density
+    bool vel_bank;
+    bool dens_bank;
+    bool temp_bank;
+    T p[MAX_SIZE][MAX_SIZE];
+    T div_[MAX_SIZE][MAX_SIZE];
+    T tmp[MAX_SIZE][MAX_SIZE]; // MacCormack scratch
+    obstacle_map obstacles;
+    stage_profile profile;
+};
+
+template <typename T>
+void fluid_reset(fluid_state<T> &state)
+{
+#pragma HLS INLINE off
+reset_i_loop:
+    for (int i = 0; i < MAX_SIZE; i++)
+    {
+    reset_j_loop:
+        for (int j = 0; j < MAX_SIZE; j++)
+        {
+            state.u[state.vel_bank][i][j] = 0.0;
+            state.v[state.vel_bank][i][j] = 0.0;
+            state.dens[state.dens_bank][i][j] = 0.0;
+            state.temp[state.temp_bank][i][j] = 0.0;
+        }
+    }
+    obstacle_clear(state.obstacles);
+}
+
+// Adds the sources straight into the fields, so there are no source grids
+// that need clearing every frame. Returns how many fell inside the fluid.
+template <typename T>
+int inject_sources(fluid_state<T> &state, const fluid_source<T> sources[MAX_SOURCES], int num_sources, float dt, int n)
+{
+#pragma HLS INLINE off
+    int injected = 0;
+inject_loop:
+    for (int k = 0; k < num_sources; k++)
+    {
+#pragma HLS LOOP_TRIPCOUNT max = MAX_SOURCES
+        fluid_source<T> s = sources[k];
+        if (s.x >= 1 && s.x < n + 1 && s.y >= 1 && s.y < n + 1 && !state.obstacles.solid[s.x][s.y])
+        {
+            state.dens[state.dens_bank][s.x][s.y] += T(dt) * s.dens;
+            state.u[state.vel_bank][s.x][s.y] += T(dt) * s.u;
+            state.v[state.vel_bank][s.x][s.y] += T(dt) * s.v;
+#if FLUID_FORCES
+            state.temp[state.temp_bank][s.x][s.y] += T(dt) * s.temp;
+#endif
+            injected++;
+        }
+    }
+    return injected;
+}
+
+// One frame of the simulation, its sources already injected. Returns the
+// solver sweeps it ran.
+template <typename T>
+int fluid_advance(fluid_state<T> &state, int n, float tol, const volatile long long &clock)
+{
+#pragma HLS INLINE off
+    int iters = vel_step(state.u, state.v, state.vel_bank, state.dens[state.dens_bank], state.temp[state.temp_bank],
+                         state.p, state.div_, state.tmp, VISC, DT, tol, state.obstacles, state.profile, clock, n);
+    iters += dens_step(state.dens, state.dens_bank, state.u[state.vel_bank], state.v[state.vel_bank], state.tmp,
+                       DIFF, DT, tol, state.obstacles, state.profile, clock, n);
+#if FLUID_FORCES
+    // Only buoyancy reads the temperature
+    iters += dens_step(state.temp, state.temp_bank, state.u[state.vel_bank], state.v[state.vel_bank], state.tmp,
+                       DIFF, DT, tol, state.obstacles, state.profile, clock, n);
+#endif
+    return iters;
+}
+
+// One frame of the simulation from its sources, the host side entry point.
+// STAGE_SOURCES is left to the caller. Returns the solver sweeps it ran.
+template <typename T>
+int fluid_step(fluid_state<T> &state, const fluid_source<T> sources[MAX_SOURCES], int num_sources, int n, float tol,
+               const volatile long long &clock)
+{
+    inject_sources(state, sources, num_sources, DT, n);
+    return fluid_advance(state, n, tol, clock);
+}
+
+// Five emitters orbiting the grid centre, the sources of the Python version,
+// each one also heating its cell with FLUID_FORCES. The kernel gets its sources from the host, this drives the testbench and
+// the bench. Returns the number of records written.
+template <typename T>
+int orbiting_sources(int frame, int n, fluid_source<T> sources[MAX_SOURCES])
+{
+    float t = frame * DT;
+    int num_sources = 5;
+    int count = 0;
+
+    for (int s = 0; s < num_sources; s++)
+    {
+        float base_angle = 2.0 * M_PI * s / num_sources;
+        float angle = base_angle + t * 0.1;
+        int radius = n / 4;
+        int cx = n / 2;
+        int cy = n / 2;
+        int x_pos = (int)(cx + radius * std::cos(angle));
+        int y_pos = (int)(cy + radius * std::sin(angle));
+        if (x_pos >= 1 && x_pos < n + 1 && y_pos >= 1 && y_pos < n + 1)
+        {
+            sources[count].x = x_pos;
+            sources[count].y = y_pos;
+            sources[count].dens = 200.0;
+            sources[count].u = 50.0 * std::cos(angle);
+            sources[count].v = 50.0 * std::sin(angle);
+            sources[count].temp = FLUID_FORCES ? 10.0 : 0.0;
+            count++;
+        }
+    }
+    return count;
+}
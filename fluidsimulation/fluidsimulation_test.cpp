@@ -1,20 +1,740 @@
 #include <iostream>
 #include <stdio.h>
+#include <cmath>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
 #include "fluidsimulation.h"
+#include "fluidsimulation_solver.h"
 
+#define N 50 // Grid size used by the testbench
+#define SIZE (N + 2)
+
+static obstacle_map open_grid; // Zeroed, no obstacles
+static long long profile[STAGE_COUNT];
+static volatile long long cycle_counter; // Unused in the C simulation, which times with steady_clock
+
+// Projects a swirling test field with the given pressure solver and returns
+// the largest remaining divergence.
+static float divergence_residual(int (*solver)(int, data_type[MAX_SIZE][MAX_SIZE], data_type[MAX_SIZE][MAX_SIZE], float, float, int, float,
+                                               const obstacle_map &, int),
+                                 int iters)
+{
+    static data_type u[MAX_SIZE][MAX_SIZE];
+    static data_type v[MAX_SIZE][MAX_SIZE];
+    static data_type p[MAX_SIZE][MAX_SIZE];
+    static data_type div_[MAX_SIZE][MAX_SIZE];
+
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            u[i][j] = std::sin(float(M_PI) * i / (N + 1)) * std::sin(3.0f * float(M_PI) * j / (N + 1));
+            v[i][j] = std::sin(2.0f * float(M_PI) * i / (N + 1)) * std::sin(float(M_PI) * j / (N + 1));
+            div_[i][j] = 0;
+            p[i][j] = 0;
+        }
+    }
+
+    for (int i = 1; i <= N; i++)
+        for (int j = 1; j <= N; j++)
+            div_[i][j] = data_type(-0.5) * ((u[i + 1][j] - u[i - 1][j]) + (v[i][j + 1] - v[i][j - 1])) / N;
+
+    solver(0, p, div_, 1, 4, iters, 0, open_grid, N);
+
+    for (int i = 1; i <= N; i++)
+    {
+        for (int j = 1; j <= N; j++)
+        {
+            u[i][j] -= data_type(0.5) * N * (p[i + 1][j] - p[i - 1][j]);
+            v[i][j] -= data_type(0.5) * N * (p[i][j + 1] - p[i][j - 1]);
+        }
+    }
+
+    // Only look at the interior, the walls are fixed up by set_bnd
+    float max_div = 0;
+    for (int i = 2; i < N; i++)
+    {
+        for (int j = 2; j < N; j++)
+        {
+            float d = std::fabs(float((u[i + 1][j] - u[i - 1][j]) + (v[i][j + 1] - v[i][j - 1])));
+            if (d > max_div)
+                max_div = d;
+        }
+    }
+    return max_div;
+}
+
+// The window advection engine has to match advect_direct() up to its fixed
+// point coordinates while the backtrace stays within ADVECT_MAX_DISPLACEMENT
+static float advect_window_error()
+{
+    static data_type d0[MAX_SIZE][MAX_SIZE];
+    static data_type u[MAX_SIZE][MAX_SIZE];
+    static data_type v[MAX_SIZE][MAX_SIZE];
+    static data_type direct[MAX_SIZE][MAX_SIZE];
+    static data_type window[MAX_SIZE][MAX_SIZE];
+
+    // A swirl reaching about 3 cells per step, dt0 = DT * N
+    float speed = 3.0f / (DT * N);
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            d0[i][j] = 100.0f * std::sin(0.3f * i) * std::cos(0.2f * j);
+            u[i][j] = speed * std::sin(float(M_PI) * j / (N + 1));
+            v[i][j] = -speed * std::sin(float(M_PI) * i / (N + 1));
+        }
+    }
+
+    advect_direct(0, direct, d0, u, v, DT, N);
+    advect_window_field(0, window, d0, u, v, DT, N);
+
+    float max_error = 0;
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            float error = std::fabs(float(direct[i][j] - window[i][j]));
+            if (error > max_error)
+                max_error = error;
+        }
+    }
+    return max_error;
+}
+
+// Carries a narrow bump across the grid with a uniform velocity, with plain
+// or MacCormack advection, and returns its peak and its minimum.
+static float advected_peak(bool maccormack, float &minimum)
+{
+    static data_type d[2][MAX_SIZE][MAX_SIZE];
+    static data_type u[MAX_SIZE][MAX_SIZE];
+    static data_type v[MAX_SIZE][MAX_SIZE];
+    static data_type tmp[MAX_SIZE][MAX_SIZE];
+
+    // 0.35 cells per step along i
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            float r2 = (i - 15) * (i - 15) + (j - N / 2) * (j - N / 2);
+            d[0][i][j] = 100.0f * std::exp(-r2 / 8.0f);
+            u[i][j] = 0.35f / (DT * N);
+            v[i][j] = 0;
+        }
+    }
+
+    int bank = 0;
+    for (int step = 0; step < 40; step++)
+    {
+        if (maccormack)
+            advect_maccormack(0, d[!bank], d[bank], u, v, tmp, DT, N);
+        else
+            advect(0, d[!bank], d[bank], u, v, DT, N);
+        bank = !bank;
+    }
+
+    float peak = 0;
+    minimum = 0;
+    for (int i = 1; i <= N; i++)
+    {
+        for (int j = 1; j <= N; j++)
+        {
+            float value = float(d[bank][i][j]);
+            peak = value > peak ? value : peak;
+            minimum = value < minimum ? value : minimum;
+        }
+    }
+    return peak;
+}
+
+// Writes the orbiting emitters of the given frame as source records and
+// returns how many there are
+static int send_sources(hls::stream<packet> &s_in, int frame, int n = N)
+{
+    fluid_source<data_type> sources[MAX_SOURCES];
+    int num_sources = orbiting_sources(frame, n, sources);
+
+    for (int k = 0; k < num_sources; k++)
+    {
+        packet word;
+        word.keep = -1;
+        word.strb = -1;
+        for (int b = 0; b < SOURCE_RECORD_BEATS; b++)
+        {
+            switch (b)
+            {
+            case 0:
+                word.data = sources[k].x | (sources[k].y << 16);
+                break;
+            case 1:
+                word.data = scalar_to_bits(sources[k].dens);
+                break;
+            case 2:
+                word.data = scalar_to_bits(sources[k].u);
+                break;
+            case 3:
+                word.data = scalar_to_bits(sources[k].v);
+                break;
+            default:
+                word.data = scalar_to_bits(sources[k].temp);
+                break;
+            }
+            word.last = (k == num_sources - 1 && b == SOURCE_RECORD_BEATS - 1);
+            s_in.write(word);
+        }
+    }
+    return num_sources;
+}
+
+// Reads one frame of beats, fails unless exactly the last one has last set
+static bool read_frame(hls::stream<packet> &s_out, int beats, int *words)
+{
+    for (int k = 0; k < beats; k++)
+    {
+        if (s_out.empty())
+            return false;
+        packet out_packet;
+        s_out.read(out_packet);
+        words[k] = out_packet.data;
+        if (bool(out_packet.last) != (k == beats - 1))
+            return false;
+    }
+    return true;
+}
+
+static float unpack(int word, int half)
+{
+    output_packed_type value;
+    value.range() = (word >> (16 * half)) & 0xffff;
+    return value.to_float();
+}
+
+// Streams every field packed and interleaved, then u and v planar as ints, and
+// checks the no-slip walls set_bnd writes into the velocity components.
+static bool check_multi_field_output(hls::stream<packet> &s_in, hls::stream<packet> &s_out, int frame, float tolerance)
+{
+    static int words[OUTPUT_FIELDS * SIZE * SIZE];
+    int iterations;
+    const float lsb = 1.0f / 64; // output_packed_type resolution, rounding may differ by one
+
+    int num_sources = send_sources(s_in, frame);
+    fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter,
+                            OUTPUT_DENSITY | OUTPUT_U | OUTPUT_V | OUTPUT_PRESSURE | OUTPUT_DIVERGENCE | OUTPUT_TEMPERATURE,
+                            OUTPUT_PACKED16, OUTPUT_INTERLEAVED);
+    if (!read_frame(s_out, (OUTPUT_FIELDS * SIZE * SIZE + 1) / 2, words) || !s_out.empty())
+    {
+        std::cout << "packed interleaved output has the wrong length" << std::endl;
+        return false;
+    }
+
+    for (int j = 1; j <= N; j++)
+    {
+        int wall = OUTPUT_FIELDS * (0 * SIZE + j) + 1;    // u[0][j]
+        int inside = OUTPUT_FIELDS * (1 * SIZE + j) + 1;  // u[1][j]
+        float u_wall = unpack(words[wall / 2], wall % 2);
+        float u_inside = unpack(words[inside / 2], inside % 2);
+        if (std::fabs(u_wall + u_inside) > lsb)
+        {
+            std::cout << "packed interleaved u does not mirror at the wall" << std::endl;
+            return false;
+        }
+    }
+
+    num_sources = send_sources(s_in, frame + 1);
+    fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter,
+                            OUTPUT_U | OUTPUT_V, OUTPUT_INT, OUTPUT_PLANAR);
+    if (!read_frame(s_out, 2 * SIZE * SIZE, words) || !s_out.empty())
+    {
+        std::cout << "planar output has the wrong length" << std::endl;
+        return false;
+    }
+
+    for (int i = 1; i <= N; i++)
+    {
+        int v_wall = words[SIZE * SIZE + i * SIZE + 0];
+        int v_inside = words[SIZE * SIZE + i * SIZE + 1];
+        if (std::abs(v_wall + v_inside) > 1)
+        {
+            std::cout << "planar v does not mirror at the wall" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Checkpoint files hold the checkpoint words as written by MODE_SAVE, the
+// header gives their count
+static bool save_checkpoint(const char *path, const int *checkpoint)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    size_t words = CHECKPOINT_WORDS(checkpoint[1]);
+    bool ok = fwrite(checkpoint, sizeof(int), words, file) == words;
+    fclose(file);
+    return ok;
+}
+
+static bool load_checkpoint(const char *path, int *checkpoint, int max_words)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    bool ok = fread(checkpoint, sizeof(int), CHECKPOINT_HEADER, file) == CHECKPOINT_HEADER &&
+              checkpoint[0] == CHECKPOINT_MAGIC && checkpoint[1] >= 2 && checkpoint[1] <= MAX_N &&
+              CHECKPOINT_WORDS(checkpoint[1]) <= max_words;
+    if (ok)
+    {
+        size_t rest = CHECKPOINT_WORDS(checkpoint[1]) - CHECKPOINT_HEADER;
+        ok = fread(checkpoint + CHECKPOINT_HEADER, sizeof(int), rest, file) == rest;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Saves the state, runs a few frames, restores the state from the file and
+// expects the same frames again
+static bool check_checkpoint(hls::stream<packet> &s_in, hls::stream<packet> &s_out, int frame, float tolerance)
+{
+    static int checkpoint[CHECKPOINT_WORDS(MAX_N)];
+    static int first[SIZE * SIZE];
+    static int second[SIZE * SIZE];
+    const int frames = 3;
+    int iterations;
+
+    if (fluidsimulation_compute(MODE_SAVE, checkpoint, s_in, s_out, 0, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED) != 0 ||
+        !save_checkpoint("fluidsimulation_checkpoint.bin", checkpoint))
+    {
+        std::cout << "saving the checkpoint failed" << std::endl;
+        return false;
+    }
+
+    for (int f = 0; f < frames; f++)
+    {
+        int num_sources = send_sources(s_in, frame + f);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        read_frame(s_out, SIZE * SIZE, first);
+    }
+
+    for (int k = 0; k < CHECKPOINT_WORDS(MAX_N); k++)
+        checkpoint[k] = 0;
+    if (!load_checkpoint("fluidsimulation_checkpoint.bin", checkpoint, CHECKPOINT_WORDS(MAX_N)) ||
+        fluidsimulation_compute(MODE_LOAD, checkpoint, s_in, s_out, 0, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED) != 0)
+    {
+        std::cout << "loading the checkpoint failed" << std::endl;
+        return false;
+    }
+
+    for (int f = 0; f < frames; f++)
+    {
+        int num_sources = send_sources(s_in, frame + f);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        read_frame(s_out, SIZE * SIZE, second);
+    }
+
+    for (int k = 0; k < SIZE * SIZE; k++)
+    {
+        if (first[k] != second[k])
+        {
+            std::cout << "restored state diverges from the saved one" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads beats up to and including the one with last set, returns their count
+// or -1 if there are more than max_beats
+static int read_until_last(hls::stream<packet> &s_out, int *words, int max_beats)
+{
+    for (int k = 0; k < max_beats && !s_out.empty(); k++)
+    {
+        packet out_packet;
+        s_out.read(out_packet);
+        words[k] = out_packet.data;
+        if (out_packet.last)
+            return k + 1;
+    }
+    return -1;
+}
+
+// Decodes an OUTPUT_DELTA8 frame onto the bytes of the previous one. Returns
+// false if it does not cover exactly the grid it announces.
+static bool decode_delta8(const int *words, int beats, unsigned char *cells, int &side)
+{
+    side = words[0] & 0xffff;
+    bool keyframe = (words[0] >> 16) & 1;
+    int count = side * side;
+    int cell = 0;
+    bool escape = false;
+
+    for (int k = 1; k < beats; k++)
+    {
+        for (int b = 0; b < 4 && cell < count; b++)
+        {
+            unsigned char byte = (words[k] >> (8 * b)) & 0xff;
+            int run = 0;
+            unsigned char d = byte;
+            if (escape)
+            {
+                escape = false;
+                run = byte;
+                d = (byte == 0) ? DELTA8_ESCAPE : 0;
+            }
+            else if (byte == DELTA8_ESCAPE)
+            {
+                escape = true;
+                continue;
+            }
+            for (int r = 0; r < (run > 0 ? run : 1); r++)
+            {
+                if (cell == count)
+                    return false;
+                cells[cell] = keyframe ? d : (unsigned char)(cells[cell] + d);
+                cell++;
+            }
+        }
+    }
+    return cell == count && !escape;
+}
+
+// Saves the state, runs a few frames as ints, restores it and runs them again
+// as OUTPUT_DELTA8. The decoded bytes have to be the quantised ints.
+static bool check_delta8_output(hls::stream<packet> &s_in, hls::stream<packet> &s_out, int frame, float tolerance)
+{
+    static int checkpoint[CHECKPOINT_WORDS(MAX_N)];
+    static int expected[8][SIZE * SIZE];
+    static int words[SIZE * SIZE];
+    static unsigned char cells[SIZE * SIZE];
+    const int frames = 8;
+    int iterations;
+
+    fluidsimulation_compute(MODE_SAVE, checkpoint, s_in, s_out, 0, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+    for (int f = 0; f < frames; f++)
+    {
+        int num_sources = send_sources(s_in, frame + f);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        read_frame(s_out, SIZE * SIZE, expected[f]);
+    }
+    fluidsimulation_compute(MODE_LOAD, checkpoint, s_in, s_out, 0, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+
+    int total_beats = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        int num_sources = send_sources(s_in, frame + f);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_DELTA8, OUTPUT_INTERLEAVED);
+        int beats = read_until_last(s_out, words, SIZE * SIZE);
+        int side;
+        if (beats < 0 || !s_out.empty() || !decode_delta8(words, beats, cells, side) || side != SIZE)
+        {
+            std::cout << "delta8 frame " << f << " is malformed" << std::endl;
+            return false;
+        }
+        total_beats += beats;
+
+        for (int k = 0; k < SIZE * SIZE; k++)
+        {
+            // value * 16 as int, to value * DELTA8_SCALE saturated
+            int q = expected[f][k] < 0 ? 0 : expected[f][k] / int(16 / DELTA8_SCALE);
+            if (cells[k] != (q > 255 ? 255 : q))
+            {
+                std::cout << "delta8 frame " << f << " decodes to the wrong density" << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "delta8 beats per frame: " << total_beats / frames << " of " << SIZE * SIZE << std::endl;
+    return true;
+}
+
+// Runs a few frames of a smaller grid as one batch that streams every second
+// frame, then again one call per frame, and expects the same frames out
+static bool check_batched_frames(hls::stream<packet> &s_in, hls::stream<packet> &s_out, float tolerance)
+{
+    const int n = 40, frames = 6, stride = 2;
+    const int beats = (n + 2) * (n + 2);
+    static int batched[frames / stride][(n + 2) * (n + 2)];
+    static int single[(n + 3) * (n + 3)];
+    int iterations;
+
+    // A different n resets the state
+    int num_sources = 0;
+    for (int f = 0; f < frames; f++)
+        num_sources = send_sources(s_in, f, n); // Five emitters in every frame
+    fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, frames, stride, n, tolerance, iterations, profile, &cycle_counter,
+                            OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+    bool complete = true;
+    for (int k = 0; k < frames / stride; k++)
+        complete = complete && read_frame(s_out, beats, batched[k]);
+    if (!complete || !s_out.empty())
+    {
+        std::cout << "batched run streamed the wrong number of beats" << std::endl;
+        return false;
+    }
+
+    // Through another size and back to start from a cleared state again
+    fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, 0, 1, 1, n + 1, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+    read_frame(s_out, (n + 3) * (n + 3), single);
+
+    for (int f = 0; f < frames; f++)
+    {
+        num_sources = send_sources(s_in, f, n);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, n, tolerance, iterations, profile, &cycle_counter,
+                                OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        read_frame(s_out, beats, single);
+        if (f % stride == stride - 1)
+        {
+            for (int k = 0; k < beats; k++)
+            {
+                if (single[k] != batched[f / stride][k])
+                {
+                    std::cout << "batched frame " << f << " differs from the single frame run" << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Walls of a square obstacle have to mirror the fluid next to them, and
+// sweeps must leave its inside alone
+static bool check_obstacle_walls()
+{
+    const int lo = 20, hi = 30; // Solid cells lo..hi in both directions
+    static obstacle_map obs;
+    static data_type x[MAX_SIZE][MAX_SIZE];
+    static data_type x0[MAX_SIZE][MAX_SIZE];
+
+    for (int i = lo; i <= hi; i++)
+        for (int j = lo; j <= hi; j++)
+            obs.solid[i][j] = 1;
+    obstacle_build(obs, N);
+
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            x[i][j] = std::sin(0.3f * i) + std::cos(0.2f * j);
+            x0[i][j] = 0;
+        }
+    }
+    data_type inside = x[lo + 5][lo + 5];
+
+    // The middle of each face has a single fluid neighbour
+    int mid = (lo + hi) / 2;
+    set_bnd(1, x, obs, N);
+    bool ok = x[lo][mid] == data_type(-x[lo - 1][mid]) && x[mid][hi] == x[mid][hi + 1];
+    set_bnd(2, x, obs, N);
+    ok = ok && x[lo][mid] == x[lo - 1][mid] && x[mid][hi] == data_type(-x[mid][hi + 1]);
+
+    lin_solve_gs<data_type>(0, x, x0, 1, 4, 5, 0, obs, N);
+    ok = ok && x[lo + 5][lo + 5] == inside && x[mid][lo] == x[mid][lo - 1];
+    lin_solve_rb<data_type>(0, x, x0, 1, 4, 5, 0, obs, N);
+    ok = ok && x[lo + 5][lo + 5] == inside && x[mid][lo] == x[mid][lo - 1];
+    return ok;
+}
+
+// Streams in a square obstacle and runs a few frames around it, its cells
+// stream out as zero and the fluid has to get past it
+static bool check_obstacles(hls::stream<packet> &s_in, hls::stream<packet> &s_out, float tolerance)
+{
+    const int lo = 20, hi = 30;
+    static int words[SIZE * SIZE];
+    int iterations;
+
+    for (int i = 0; i < SIZE; i++)
+    {
+        for (int beat = 0; beat < OBSTACLE_ROW_BEATS(N); beat++)
+        {
+            packet word;
+            word.data = 0;
+            for (int b = 0; b < 32; b++)
+            {
+                int j = 32 * beat + b;
+                if (i >= lo && i <= hi && j >= lo && j <= hi)
+                    word.data |= 1 << b;
+            }
+            word.keep = -1;
+            word.strb = -1;
+            word.last = (i == SIZE - 1 && beat == OBSTACLE_ROW_BEATS(N) - 1);
+            s_in.write(word);
+        }
+    }
+    if (fluidsimulation_compute(MODE_OBSTACLES, nullptr, s_in, s_out, 0, 1, 1, N, tolerance, iterations, profile, &cycle_counter,
+                                OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED) != 0 ||
+        !s_in.empty())
+    {
+        std::cout << "loading the obstacle mask failed" << std::endl;
+        return false;
+    }
+
+    for (int f = 0; f < 30; f++)
+    {
+        int num_sources = send_sources(s_in, f);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter,
+                                OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        read_frame(s_out, SIZE * SIZE, words);
+    }
+
+    int outside = 0;
+    for (int i = 1; i <= N; i++)
+    {
+        for (int j = 1; j <= N; j++)
+        {
+            bool solid = i >= lo && i <= hi && j >= lo && j <= hi;
+            if (solid && words[i * SIZE + j] != 0)
+            {
+                std::cout << "obstacle cells are not empty" << std::endl;
+                return false;
+            }
+            if (!solid && (i == lo - 1 || i == hi + 1 || j == lo - 1 || j == hi + 1) && words[i * SIZE + j] > 0)
+                outside++;
+        }
+    }
+    if (outside == 0)
+    {
+        std::cout << "no fluid reached the obstacle" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#if ADVECT_SCHEME == ADVECT_SEMI_LAGRANGIAN
+// vel_step has to give the same velocity whether or not the advection is
+// fused into the divergence pass. The fused path advects the velocity
+// first-order, so this only holds with ADVECT_SEMI_LAGRANGIAN.
+static bool check_fused_velocity()
+{
+    static fluid_state<data_type> fused;
+    static fluid_state<data_type> unfused;
+
+    fluid_reset(fused);
+    for (int frame = 0; frame < 20; frame++)
+    {
+        fluid_source<data_type> sources[MAX_SOURCES];
+        int num_sources = orbiting_sources(frame, N, sources);
+        fluid_step(fused, sources, num_sources, N, 0, cycle_counter);
+    }
+    unfused = fused;
+
+    for (int frame = 20; frame < 30; frame++)
+    {
+        fluid_source<data_type> sources[MAX_SOURCES];
+        int num_sources = orbiting_sources(frame, N, sources);
+        inject_sources(fused, sources, num_sources, DT, N);
+        inject_sources(unfused, sources, num_sources, DT, N);
+        vel_step<data_type, true>(fused.u, fused.v, fused.vel_bank, fused.dens[fused.dens_bank], fused.temp[fused.temp_bank],
+                                  fused.p, fused.div_, fused.tmp, VISC, DT, 0, fused.obstacles, fused.profile, cycle_counter, N);
+        vel_step<data_type, false>(unfused.u, unfused.v, unfused.vel_bank, unfused.dens[unfused.dens_bank],
+                                   unfused.temp[unfused.temp_bank], unfused.p, unfused.div_, unfused.tmp, VISC, DT, 0,
+                                   unfused.obstacles, unfused.profile, cycle_counter, N);
+        if (fused.vel_bank != unfused.vel_bank)
+            return false;
+        for (int i = 0; i < SIZE; i++)
+            for (int j = 0; j < SIZE; j++)
+                if (fused.u[fused.vel_bank][i][j] != unfused.u[unfused.vel_bank][i][j] ||
+                    fused.v[fused.vel_bank][i][j] != unfused.v[unfused.vel_bank][i][j])
+                    return false;
+        dens_step(fused.dens, fused.dens_bank, fused.u[fused.vel_bank], fused.v[fused.vel_bank], fused.tmp, DIFF, DT, 0,
+                  fused.obstacles, fused.profile, cycle_counter, N);
+        dens_step(unfused.dens, unfused.dens_bank, unfused.u[unfused.vel_bank], unfused.v[unfused.vel_bank], unfused.tmp,
+                  DIFF, DT, 0, unfused.obstacles, unfused.profile, cycle_counter, N);
+    }
+    return true;
+}
+#endif
+
+// The solver, advection and force switches of fluidsimulation.h can be set
+// from the compiler; besides the defaults this has to pass with each of
+//   -DSOLVER=SOLVER_RED_BLACK, -DSOLVER=SOLVER_MULTIGRID,
+//   -DADVECT_ENGINE=ADVECT_ENGINE_WINDOW, -DADVECT_SCHEME=ADVECT_MACCORMACK,
+//   -DFUSED_ADVECT_PROJECT=0 and -DFLUID_FORCES=1
 int main() 
 {
+    float gs_residual = divergence_residual(lin_solve_gs<data_type>, PROJECT_ITERS);
+    float rb_residual = divergence_residual(lin_solve_rb<data_type>, PROJECT_ITERS);
+    float mg_residual = divergence_residual(lin_solve_mg<data_type>, MG_CYCLES);
+    std::cout << "divergence residual gauss-seidel: " << gs_residual << " red-black: " << rb_residual
+              << " multigrid: " << mg_residual << std::endl;
+    if (rb_residual > 1.1f * gs_residual + 1e-3f)
+    {
+        std::cout << "red-black solver does not converge like gauss-seidel" << std::endl;
+        return 1;
+    }
+    if (mg_residual > gs_residual)
+    {
+        std::cout << "multigrid solver does not converge faster than gauss-seidel" << std::endl;
+        return 1;
+    }
+
+    float window_error = advect_window_error();
+    std::cout << "advect window engine error: " << window_error << std::endl;
+    if (window_error > 0.05f)
+    {
+        std::cout << "window advection engine does not match advect_direct" << std::endl;
+        return 1;
+    }
+
+    float minimum;
+    float semi_lagrangian_peak = advected_peak(false, minimum);
+    float maccormack_peak = advected_peak(true, minimum);
+    std::cout << "advected bump peak semi-lagrangian: " << semi_lagrangian_peak
+              << " maccormack: " << maccormack_peak << std::endl;
+    if (maccormack_peak <= semi_lagrangian_peak || maccormack_peak > 100.0f || minimum < 0.0f)
+    {
+        std::cout << "maccormack advection is not sharper or overshoots" << std::endl;
+        return 1;
+    }
+
+#if ADVECT_SCHEME == ADVECT_SEMI_LAGRANGIAN
+    if (!check_fused_velocity())
+    {
+        std::cout << "fused and unfused vel_step give different velocities" << std::endl;
+        return 1;
+    }
+#endif
+
+    // With DIFF = 0 diffuse() is converged after one sweep, the early exit
+    // should stop it at the first residual check.
+    static data_type dens_test[MAX_SIZE][MAX_SIZE];
+    static data_type dens_test_prev[MAX_SIZE][MAX_SIZE];
+    dens_test_prev[N / 2][N / 2] = 200.0;
+    int diffuse_sweeps = lin_solve_gs<data_type>(0, dens_test, dens_test_prev, DT * DIFF * N * N, 1 + 4 * DT * DIFF * N * N, DIFFUSE_ITERS, 1e-3f, open_grid, N);
+    std::cout << "diffuse sweeps with tolerance: " << diffuse_sweeps << std::endl;
+    if (diffuse_sweeps != RESIDUAL_CHECK_INTERVAL)
+    {
+        std::cout << "early exit did not trigger" << std::endl;
+        return 1;
+    }
+
+    if (!check_obstacle_walls())
+    {
+        std::cout << "obstacle walls do not mirror the fluid next to them" << std::endl;
+        return 1;
+    }
+
     cv::Mat output_buffer(SIZE, SIZE, CV_8UC1, cv::Scalar(0));
 
+	hls::stream<packet> s_in;
 	hls::stream<packet> s_out;
-    
+
+    float tolerance = 0.0f; // Run the full sweep counts
+    int iterations = 0;
+    int total_iterations = 0;
+    long long total_profile[STAGE_COUNT] = {0};
+
     for(int i = 0; i < 100; i++)
     {
-        fluidsimulation_compute(s_out, i);
+        int num_sources = send_sources(s_in, i);
+        fluidsimulation_compute(MODE_RUN, nullptr, s_in, s_out, num_sources, 1, 1, N, tolerance, iterations, profile, &cycle_counter, OUTPUT_DENSITY, OUTPUT_INT, OUTPUT_INTERLEAVED);
+        total_iterations += iterations;
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+            total_profile[stage] += profile[stage];
 
         for (int y = 0; y < SIZE; y++)
         {
@@ -28,6 +748,39 @@ int main()
         }
     }
 
+    std::cout << "mean solver sweeps per frame: " << total_iterations / 100 << std::endl;
+
+    // Every stage that ran took some time, the forces only exist with FLUID_FORCES
+    bool profile_ok = FLUID_FORCES ? total_profile[STAGE_FORCES] > 0 : total_profile[STAGE_FORCES] == 0;
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        if (stage != STAGE_FORCES && total_profile[stage] <= 0)
+            profile_ok = false;
+    if (!profile_ok)
+    {
+        std::cout << "stage profile misses a stage" << std::endl;
+        return 1;
+    }
+    std::cout << "ns per frame:";
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        std::cout << " " << total_profile[stage] / 100;
+    std::cout << std::endl;
+    fluidsimulation_print_profile();
+
+    if (!check_checkpoint(s_in, s_out, 100, tolerance))
+        return 1;
+
+    if (!check_multi_field_output(s_in, s_out, 103, tolerance))
+        return 1;
+
+    if (!check_delta8_output(s_in, s_out, 105, tolerance))
+        return 1;
+
+    if (!check_batched_frames(s_in, s_out, tolerance))
+        return 1;
+
+    if (!check_obstacles(s_in, s_out, tolerance))
+        return 1;
+
     cv::imwrite("fluidsimulation_ouput.png", output_buffer);
 
     return 0;
@@ -77,3 +77,145 @@ extern "C"
         return 0;
     }
 }
+
+#include "ap_int.h"
+#include "gameoflife_packed.h"
+
+typedef ap_uint<64> word_type;
+typedef ap_uint<512> wide_type; // 64 bool cells, one byte each
+
+// Conversions between the words in DDR and 64 packed cells
+static word_type cells_of(word_type word)
+{
+#pragma HLS INLINE
+    return word;
+}
+
+static word_type beat_of(word_type cells, word_type)
+{
+#pragma HLS INLINE
+    return cells;
+}
+
+static word_type cells_of(wide_type beat)
+{
+#pragma HLS INLINE
+    word_type cells;
+cells_of_loop:
+    for (int b = 0; b < 64; b++)
+        cells[b] = beat[8 * b];
+    return cells;
+}
+
+static wide_type beat_of(word_type cells, wide_type)
+{
+#pragma HLS INLINE
+    wide_type beat = 0;
+beat_of_loop:
+    for (int b = 0; b < 64; b++)
+        beat[8 * b] = cells[b];
+    return beat;
+}
+
+// Streams the grid through once, 64 cells per cycle, with the two rows above
+// the newest word held in line buffers. Sequential accesses on both ports let
+// HLS turn them into bursts. See gameoflife_compute_packed for the limits.
+template <typename T>
+static int life_stream(T *in_grid, T *out_grid, unsigned int grid_width, unsigned int grid_height)
+{
+#pragma HLS INLINE
+    if (grid_width % 64 != 0 || grid_width < 128 || grid_width > PACKED_MAX_WIDTH)
+        return -1;
+
+    int row_words = grid_width / 64;
+    int words = row_words * grid_height;
+
+    // Words t - row_words and t - 2 * row_words of the newest word t
+    word_type line_1[PACKED_MAX_ROW_WORDS];
+    word_type line_2[PACKED_MAX_ROW_WORDS];
+#pragma HLS DEPENDENCE variable = line_1 inter false
+#pragma HLS DEPENDENCE variable = line_2 inter false
+    int line_address = 0;
+
+    // Three consecutive words of each row, the newest one first. Output
+    // word m = t - row_words - 1 is mid[1].
+    word_type up[3] = {0, 0, 0};
+    word_type mid[3] = {0, 0, 0};
+    word_type down[3] = {0, 0, 0};
+#pragma HLS ARRAY_PARTITION variable = up complete
+#pragma HLS ARRAY_PARTITION variable = mid complete
+#pragma HLS ARRAY_PARTITION variable = down complete
+
+life_stream_loop:
+    for (int t = 0; t <= words + row_words; t++)
+    {
+#pragma HLS loop_tripcount min = 16384 max = 16384 avg = 16384
+#pragma HLS PIPELINE II = 1
+
+        // Past the end the frozen last cells are the only readers
+        word_type data = 0;
+        if (t < words)
+            data = cells_of(in_grid[t]);
+
+        word_type last_line_1 = line_1[line_address];
+        word_type last_line_2 = line_2[line_address];
+        line_1[line_address] = data;
+        line_2[line_address] = last_line_1;
+        line_address++;
+        if (line_address == row_words)
+            line_address = 0;
+
+        down[2] = down[1];
+        down[1] = down[0];
+        down[0] = data;
+
+        mid[2] = mid[1];
+        mid[1] = mid[0];
+        mid[0] = last_line_1;
+
+        up[2] = up[1];
+        up[1] = up[0];
+        up[0] = last_line_2;
+
+        int m = t - row_words - 1;
+        if (m >= 0)
+        {
+            word_type new_word = life_word(up[2], up[1], up[0], mid[2], mid[1], mid[0], down[2], down[1], down[0]);
+            word_type frozen = life_frozen_mask<word_type>(m, grid_width, grid_height);
+            out_grid[m] = beat_of((new_word & ~frozen) | (mid[1] & frozen), T());
+        }
+    }
+
+    return 0;
+}
+
+extern "C"
+{
+    // Bit-packed version of gameoflife_compute, see gameoflife_packed.h for the
+    // layout. grid_width has to be a multiple of 64 and at least 128, returns
+    // -1 otherwise.
+    int gameoflife_compute_packed(word_type *in_grid, word_type *out_grid, unsigned int grid_width, unsigned int grid_height)
+    {
+#pragma HLS INTERFACE m_axi port = in_grid bundle = gmem0
+#pragma HLS INTERFACE m_axi port = out_grid bundle = gmem1
+#pragma HLS INTERFACE mode = s_axilite port = grid_width
+#pragma HLS INTERFACE mode = s_axilite port = grid_height
+#pragma HLS INTERFACE mode = s_axilite port = return
+
+        return life_stream(in_grid, out_grid, grid_width, grid_height);
+    }
+
+    // Drop-in for gameoflife_compute on the same one-bool-per-byte buffers,
+    // moved as 512-bit beats of 64 cells so every access is a full-width
+    // burst beat instead of a byte. Same limits as gameoflife_compute_packed.
+    int gameoflife_compute_wide(wide_type *in_grid, wide_type *out_grid, unsigned int grid_width, unsigned int grid_height)
+    {
+#pragma HLS INTERFACE m_axi port = in_grid bundle = gmem0 max_read_burst_length = 64
+#pragma HLS INTERFACE m_axi port = out_grid bundle = gmem1 max_write_burst_length = 64
+#pragma HLS INTERFACE mode = s_axilite port = grid_width
+#pragma HLS INTERFACE mode = s_axilite port = grid_height
+#pragma HLS INTERFACE mode = s_axilite port = return
+
+        return life_stream(in_grid, out_grid, grid_width, grid_height);
+    }
+}
@@ -0,0 +1,49 @@
+#include "gameoflife_host.h"
+
+#include "gameoflife_packed.h"
+
+void gameoflife_host_pack(const bool *cells, uint64_t *words, unsigned int grid_width, unsigned int grid_height)
+{
+    int count = grid_width * grid_height / 64;
+    for (int m = 0; m < count; m++)
+    {
+        uint64_t word = 0;
+        for (int b = 0; b < 64; b++)
+            word |= uint64_t(cells[m * 64 + b]) << b;
+        words[m] = word;
+    }
+}
+
+void gameoflife_host_unpack(const uint64_t *words, bool *cells, unsigned int grid_width, unsigned int grid_height)
+{
+    int count = grid_width * grid_height / 64;
+    for (int m = 0; m < count; m++)
+        for (int b = 0; b < 64; b++)
+            cells[m * 64 + b] = (words[m] >> b) & 1;
+}
+
+int gameoflife_host_step(const uint64_t *in_grid, uint64_t *out_grid, unsigned int grid_width, unsigned int grid_height)
+{
+    if (grid_width % 64 != 0)
+        return -1;
+
+    int row_words = grid_width / 64;
+    int words = row_words * grid_height;
+
+    // Words outside the grid only reach frozen cells, read them as 0
+    auto word = [&](int m) -> uint64_t
+    {
+        return (m >= 0 && m < words) ? in_grid[m] : 0;
+    };
+
+    for (int m = 0; m < words; m++)
+    {
+        uint64_t new_word = life_word<uint64_t>(word(m - row_words - 1), word(m - row_words), word(m - row_words + 1),
+                                                word(m - 1), in_grid[m], word(m + 1),
+                                                word(m + row_words - 1), word(m + row_words), word(m + row_words + 1));
+        uint64_t frozen = life_frozen_mask<uint64_t>(m, grid_width, grid_height);
+        out_grid[m] = (new_word & ~frozen) | (in_grid[m] & frozen);
+    }
+
+    return 0;
+}
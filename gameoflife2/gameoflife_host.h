@@ -0,0 +1,28 @@
+#pragma once
+
+// Bit-packed Game of Life on the ARM cores, the same word-parallel update as
+// gameoflife_compute_packed, see gameoflife_packed.h for the layout.
+//
+// Build as a shared library for the notebooks with
+//   g++ -O3 -shared -fPIC gameoflife_host.cpp -o libgameoflife_host.so
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Converts between one bool per cell and 64 cells per word, grid_width
+    // has to be a multiple of 64
+    void gameoflife_host_pack(const bool *cells, uint64_t *words, unsigned int grid_width, unsigned int grid_height);
+    void gameoflife_host_unpack(const uint64_t *words, bool *cells, unsigned int grid_width, unsigned int grid_height);
+
+    // One generation from in_grid to out_grid. Returns -1 if grid_width is
+    // not a multiple of 64.
+    int gameoflife_host_step(const uint64_t *in_grid, uint64_t *out_grid, unsigned int grid_width, unsigned int grid_height);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+// Bit-packed Game of Life, shared by the HLS kernel and the host version.
+// Cell k = i * grid_width + j of the grid is bit k % 64 of word k / 64, so
+// with grid_width a multiple of 64 every row is a whole number of words.
+//
+// Like gameoflife_compute the grid is treated as one long row of cells:
+// the neighbours of cell k are k +- 1 and k +- grid_width (+- 1), the left
+// neighbour of a row's first cell being the last cell of the row above.
+// Cells with a neighbour outside the grid, k < grid_width + 1 or
+// k + grid_width + 1 >= grid_width * grid_height, keep their value.
+#define PACKED_MAX_WIDTH 8192 // Widest grid, bounds the line buffers
+#define PACKED_MAX_ROW_WORDS (PACKED_MAX_WIDTH / 64)
+
+// Next value of the 64 cells of word centre. Each row is given as its word
+// and the words before and after it, so the cells shifted in at either end
+// come from the neighbouring words.
+template <typename T>
+T life_word(T up_prev, T up, T up_next, T prev, T centre, T next, T down_prev, T down, T down_next)
+{
+#pragma HLS INLINE
+    // The eight neighbours of every cell of the word, one bit vector each
+    T n0 = T(up << 1) | T(up_prev >> 63);
+    T n1 = up;
+    T n2 = T(up >> 1) | T(up_next << 63);
+    T n3 = T(centre << 1) | T(prev >> 63);
+    T n4 = T(centre >> 1) | T(next << 63);
+    T n5 = T(down << 1) | T(down_prev >> 63);
+    T n6 = down;
+    T n7 = T(down >> 1) | T(down_next << 63);
+
+    // Full adders sum them bit-wise into ones (a0), twos (a1) and fours (a2),
+    // a count of 8 wraps to 0 which is dead just like it should be
+    T s_a = n0 ^ n1 ^ n2;
+    T c_a = (n0 & n1) | (n2 & (n0 ^ n1));
+    T s_b = n3 ^ n4 ^ n5;
+    T c_b = (n3 & n4) | (n5 & (n3 ^ n4));
+    T s_c = n6 ^ n7;
+    T c_c = n6 & n7;
+
+    T a0 = s_a ^ s_b ^ s_c;
+    T c_0 = (s_a & s_b) | (s_c & (s_a ^ s_b));
+    T t = c_a ^ c_b ^ c_c;
+    T c_1 = (c_a & c_b) | (c_c & (c_a ^ c_b));
+    T a1 = t ^ c_0;
+    T a2 = c_1 ^ T(t & c_0);
+
+    // Born with 3, survives with 2 or 3
+    return a1 & T(~a2) & (a0 | centre);
+}
+
+// Bits of word m whose cells keep their value, see above
+template <typename T>
+T life_frozen_mask(int m, int grid_width, int grid_height)
+{
+#pragma HLS INLINE
+    int first = m * 64;
+    int low = grid_width + 1 - first;                             // Cells below this bit are frozen
+    int high = grid_width * grid_height - grid_width - 1 - first; // and so are the ones from this bit on
+
+    T ones = ~T(0);
+    T mask = 0;
+    if (low >= 64)
+        mask = ones;
+    else if (low > 0)
+        mask = ones >> (64 - low);
+    if (high <= 0)
+        mask = ones;
+    else if (high < 64)
+        mask |= T(ones << high);
+    return mask;
+}
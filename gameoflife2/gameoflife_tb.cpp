@@ -1,13 +1,18 @@
+#include <chrono>
 #include <iostream>
 #include <stdio.h>
 #include <ap_fixed.h>
 
+#include "gameoflife_host.h"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 extern "C"
 {
     int gameoflife_compute(bool *in_grid, bool *out_grid, unsigned int width, unsigned int height);
+    int gameoflife_compute_packed(ap_uint<64> *in_grid, ap_uint<64> *out_grid, unsigned int width, unsigned int height);
+    int gameoflife_compute_wide(ap_uint<512> *in_grid, ap_uint<512> *out_grid, unsigned int width, unsigned int height);
 }
 
 ap_uint<16> lfsr_random()
@@ -54,13 +59,76 @@ int main()
     bool *grid = grid1;
     bool *back_grid = grid2;
 
+    // The packed and wide kernels and the host version run alongside and have
+    // to match the scalar kernel after every generation
+    int words = width * height / 64;
+    static ap_uint<64> kernel_words[2][1024 * 1024 / 64];
+    static ap_uint<512> wide_beats[2][1024 * 1024 / 64];
+    static uint64_t host_words[2][1024 * 1024 / 64];
+    gameoflife_host_pack(grid, host_words[0], width, height);
+    for (int m = 0; m < words; m++)
+    {
+        kernel_words[0][m] = host_words[0][m];
+        // The bytes of 64 bools, the first one in the low byte
+        for (int b = 0; b < 64; b++)
+            wide_beats[0][m].range(8 * b + 7, 8 * b) = grid[m * 64 + b];
+    }
+
+    double scalar_seconds = 0, packed_seconds = 0, wide_seconds = 0, host_seconds = 0;
     for (int i = 0; i < 1000; i++)
     {
+        int in = i % 2, out = 1 - in;
+
+        auto start = std::chrono::steady_clock::now();
         gameoflife_compute(grid, back_grid, width, height);
+        auto scalar_end = std::chrono::steady_clock::now();
+        int packed_status = gameoflife_compute_packed(kernel_words[in], kernel_words[out], width, height);
+        auto packed_end = std::chrono::steady_clock::now();
+        int wide_status = gameoflife_compute_wide(wide_beats[in], wide_beats[out], width, height);
+        auto wide_end = std::chrono::steady_clock::now();
+        int host_status = gameoflife_host_step(host_words[in], host_words[out], width, height);
+        auto host_end = std::chrono::steady_clock::now();
+
+        scalar_seconds += std::chrono::duration<double>(scalar_end - start).count();
+        packed_seconds += std::chrono::duration<double>(packed_end - scalar_end).count();
+        wide_seconds += std::chrono::duration<double>(wide_end - packed_end).count();
+        host_seconds += std::chrono::duration<double>(host_end - wide_end).count();
+
         //std::swap(grid, back_grid);
         bool *temp = grid;
         grid = back_grid;
         back_grid = temp;
+
+        if (packed_status != 0 || wide_status != 0 || host_status != 0)
+        {
+            std::cout << "packed versions rejected the grid" << std::endl;
+            return 1;
+        }
+        for (int m = 0; m < words; m++)
+        {
+            uint64_t expected = 0;
+            for (int b = 0; b < 64; b++)
+                expected |= uint64_t(grid[m * 64 + b]) << b;
+            bool wide_matches = true;
+            for (int b = 0; b < 64; b++)
+                wide_matches &= wide_beats[out][m].range(8 * b + 7, 8 * b) == (unsigned int)grid[m * 64 + b];
+            if (kernel_words[out][m] != expected || host_words[out][m] != expected || !wide_matches)
+            {
+                std::cout << "packed versions differ from gameoflife_compute in generation " << i + 1 << std::endl;
+                return 1;
+            }
+        }
+    }
+    std::cout << "seconds for 1000 generations, scalar: " << scalar_seconds << " packed kernel: " << packed_seconds
+              << " wide kernel: " << wide_seconds << " host: " << host_seconds << std::endl;
+
+    // Widths the packed kernel cannot stream
+    if (gameoflife_compute_packed(kernel_words[0], kernel_words[1], 96, 64) != -1 ||
+        gameoflife_compute_packed(kernel_words[0], kernel_words[1], 64, 64) != -1 ||
+        gameoflife_compute_wide(wide_beats[0], wide_beats[1], 96, 64) != -1)
+    {
+        std::cout << "gameoflife_compute_packed accepted an unsupported width" << std::endl;
+        return 1;
     }
 
     unsigned char grid_out[width * height];
@@ -1,6 +1,5 @@
 
-#include "ap_axi_sdata.h"
-#include "hls_stream.h"
+#include "gameoflife.h"
 
 template <typename T, int width>
 class fifo_shiftreg_1
@@ -86,111 +85,374 @@ private:
     int width;
 };
 
+// A cell is bit 0 of its beat, the line buffers only store that bit
+typedef ap_uint<1> cell_type;
+typedef ap_uint<32> word_type; // 32 cells, the first one in bit 0
+
+// Next value of the window centre mat3[4]. mat3[0..2] is the row below,
+// mat3[3..5] the centre row and mat3[6..8] the row above, each with the
+// newest (rightmost) column first.
+static cell_type life_cells(const cell_type mat3[9])
+{
+#pragma HLS INLINE
+    // Compute the sum of the 8 neighbors
+    int total = 0;
+compute_sum_loop:
+    for (int i = 0; i < 9; i++)
+    {
+        if (i == 4)
+            continue;
+        total += mat3[i];
+    }
+
+    cell_type old_val = mat3[4];
+    cell_type new_val = old_val;
+    // Apply Conway's Game of Life rules
+    if (old_val == 1)
+    {
+        if (total < 2 || total > 3)
+        {
+            new_val = 0;
+        }
+    }
+    else
+    {
+        if (total == 3)
+        {
+            new_val = 1;
+        }
+    }
+    return new_val;
+}
+
+// The same for all 32 cells of the centre word at once. Of the words on
+// either side only the nearest bit is used, a 3 x 34 cell window.
+static word_type life_cells(const word_type mat3[9])
+{
+#pragma HLS INLINE
+    // Neighbours to the left and right of every cell, row by row
+    word_type below_l = (mat3[1] << 1) | (mat3[2] >> 31);
+    word_type below_r = (mat3[1] >> 1) | (mat3[0] << 31);
+    word_type centre_l = (mat3[4] << 1) | (mat3[5] >> 31);
+    word_type centre_r = (mat3[4] >> 1) | (mat3[3] << 31);
+    word_type above_l = (mat3[7] << 1) | (mat3[8] >> 31);
+    word_type above_r = (mat3[7] >> 1) | (mat3[6] << 31);
+
+    // Sum the eight bits of every cell with full adders into ones, twos and
+    // fours, a count of 8 wraps around to 0 which is as dead as it should be
+    word_type s_a = below_l ^ mat3[1] ^ below_r;
+    word_type c_a = (below_l & mat3[1]) | (below_r & (below_l ^ mat3[1]));
+    word_type s_b = above_l ^ mat3[7] ^ above_r;
+    word_type c_b = (above_l & mat3[7]) | (above_r & (above_l ^ mat3[7]));
+    word_type s_c = centre_l ^ centre_r;
+    word_type c_c = centre_l & centre_r;
+
+    word_type ones = s_a ^ s_b ^ s_c;
+    word_type c_ones = (s_a & s_b) | (s_c & (s_a ^ s_b));
+    word_type t = c_a ^ c_b ^ c_c;
+    word_type c_t = (c_a & c_b) | (c_c & (c_a ^ c_b));
+    word_type twos = t ^ c_ones;
+    word_type fours = c_t ^ (t & c_ones);
+
+    // Born with 3, survives with 2 or 3
+    return twos & ~fours & (ones | mat3[4]);
+}
+
+// Cells of the value at (row, column) on the border of the grid, columns
+// and rows counted in values
+static cell_type border_cells(cell_type, int row, int column, int columns, int rows)
+{
+#pragma HLS INLINE
+    return row == 0 || row == rows - 1 || column == 0 || column == columns - 1;
+}
+
+static word_type border_cells(word_type, int row, int column, int columns, int rows)
+{
+#pragma HLS INLINE
+    word_type mask = 0;
+    if (row == 0 || row == rows - 1)
+        mask = ~word_type(0);
+    if (column == 0)
+        mask[0] = 1;
+    if (column == columns - 1)
+        mask[31] = 1;
+    return mask;
+}
+
+// One generation of a grid streamed in and out row by row, columns values of
+// type T per row: single cells as cell_type or 32 cells per word_type.
+//
+// The grid is surrounded by ghost rows and columns that are fed through the
+// same line buffers as the cells, so every boundary mode runs at the same
+// rate. Ghost columns are filled in when a row leaves the first line buffer,
+// by then the whole row has been seen. The bottom ghost row of
+// BOUNDARY_TOROIDAL is the first row kept on chip, its top ghost row has to
+// come first in the input: cells_in carries the last row, followed by the
+// grid, rows + 1 rows in total.
+template <typename T, int max_columns>
+static void life_stage(hls::stream<T> &cells_in, hls::stream<T> &cells_out, int columns, int rows, int boundary)
+{
+#pragma HLS INLINE off
+    bool toroidal = boundary == BOUNDARY_TOROIDAL;
+
+    // Rows are columns + 2 values long, a ghost column on either side.
+    // ghost_line delays the cells by one row, the other two make up the
+    // 3x3 window together with its shift registers.
+    fifo_bram<T, max_columns + 3> ghost_line(columns + 3);
+
+    // Only for columns == max_columns
+    // fifo_shiftreg_1<T, max_columns - 1> line_1;
+    // fifo_shiftreg_1<T, max_columns - 1> line_2;
+
+    // fifo_shiftreg_2<T, max_columns> line_1(columns - 1);
+    // fifo_shiftreg_2<T, max_columns> line_2(columns - 1);
+
+    fifo_bram<T, max_columns> line_1(columns);
+    fifo_bram<T, max_columns> line_2(columns);
+
+    // Row 0 for the bottom ghost row of BOUNDARY_TOROIDAL
+    T first_row[max_columns];
+
+    // First and last value of the row going into ghost_line and of the one
+    // coming out of it, the ghost columns of the latter
+    T first_in = 0, last_in = 0;
+    T first_out = 0, last_out = 0;
+
+    T mat3[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+#pragma HLS ARRAY_PARTITION variable = mat3 complete
+
+    // Row y of the input is entering while the window is centred on
+    // grid row y - 2 and column x - 1
+stage_y_loop:
+    for (int y = -1; y <= rows + 1; y++)
+    {
+#pragma HLS loop_tripcount max = TRIPCOUNT_ROWS + 3
+
+    stage_x_loop:
+        for (int x = -1; x <= columns; x++)
+        {
+#pragma HLS loop_tripcount max = max_columns + 2
+#pragma HLS PIPELINE II = 1
+
+            if (x == -1)
+            {
+                first_out = first_in;
+                last_out = last_in;
+            }
+
+            // Cells of the grid and of the ghost rows, 0 in the ghost columns
+            T data = 0;
+            bool cell = x >= 0 && x < columns;
+            if (cell && ((y >= 0 && y < rows) || (y == -1 && toroidal)))
+                data = cells_in.read();
+            if (cell && y == 0)
+                first_row[x] = data;
+            if (cell && y == rows && toroidal)
+                data = first_row[x];
+
+            if (x == 0)
+                first_in = data;
+            if (x == columns - 1)
+                last_in = data;
+
+            // The row before, with its ghost columns
+            T delayed = ghost_line.shift(data);
+            if (x == -1 && toroidal)
+                delayed = last_out;
+            if (x == columns && toroidal)
+                delayed = first_out;
+
+            T last_line_1 = line_1.shift(mat3[2]);
+            T last_line_2 = line_2.shift(mat3[5]);
+
+            mat3[8] = mat3[7];
+            mat3[7] = mat3[6];
+            mat3[6] = last_line_2;
+
+            mat3[5] = mat3[4];
+            mat3[4] = mat3[3];
+            mat3[3] = last_line_1;
+
+            mat3[2] = mat3[1];
+            mat3[1] = mat3[0];
+            mat3[0] = delayed;
+
+            T old_val = mat3[4];
+            T new_val = life_cells(mat3);
+
+            int row = y - 2, column = x - 1;
+            if (boundary == BOUNDARY_FROZEN)
+            {
+                T frozen = border_cells(T(), row, column, columns, rows);
+                new_val = (new_val & ~frozen) | (old_val & frozen);
+            }
+
+            if (row >= 0 && column >= 0)
+                cells_out.write(new_val);
+        }
+    }
+}
+
+// Moves the values between the AXI streams and the stages, TLAST on the last one
+template <typename T, int max_columns>
+static void read_cells(hls::stream<packet> &stream_in, hls::stream<T> &cells, int count)
+{
+read_cells_loop:
+    for (int k = 0; k < count; k++)
+    {
+#pragma HLS loop_tripcount max = max_columns * (TRIPCOUNT_ROWS + 1)
+#pragma HLS PIPELINE II = 1
+        packet package_in;
+        stream_in.read(package_in);
+        cells.write(T(package_in.data));
+    }
+}
+
+template <typename T, int max_columns>
+static void write_cells(hls::stream<T> &cells, hls::stream<packet> &stream_out, int count)
+{
+write_cells_loop:
+    for (int k = 0; k < count; k++)
+    {
+#pragma HLS loop_tripcount max = max_columns * TRIPCOUNT_ROWS
+#pragma HLS PIPELINE II = 1
+        packet package_out;
+        package_out.data = cells.read();
+        package_out.keep = -1;
+        package_out.strb = -1;
+        if (k == count - 1)
+            package_out.last = 1;
+        else
+            package_out.last = 0;
+        stream_out.write(package_out);
+    }
+}
+
+// K stages in a row, each with its own line buffers, generation k + 1 starts
+// as soon as the first rows of generation k come out
+template <int K, typename T, int max_columns>
+struct life_chain
+{
+    static void run(hls::stream<T> &cells_in, hls::stream<T> &cells_out, int columns, int rows, int boundary)
+    {
+#pragma HLS INLINE
+        hls::stream<T> cells_between;
+#pragma HLS STREAM variable = cells_between depth = 2
+        life_stage<T, max_columns>(cells_in, cells_between, columns, rows, boundary);
+        life_chain<K - 1, T, max_columns>::run(cells_between, cells_out, columns, rows, boundary);
+    }
+};
+
+template <typename T, int max_columns>
+struct life_chain<1, T, max_columns>
+{
+    static void run(hls::stream<T> &cells_in, hls::stream<T> &cells_out, int columns, int rows, int boundary)
+    {
+#pragma HLS INLINE
+        life_stage<T, max_columns>(cells_in, cells_out, columns, rows, boundary);
+    }
+};
+
+template <int K, typename T, int max_columns>
+static void life_dataflow(hls::stream<packet> &stream_in, hls::stream<packet> &stream_out, int columns, int rows, int boundary)
+{
+#pragma HLS INLINE off
+#pragma HLS DATAFLOW
+    hls::stream<T> cells_in;
+    hls::stream<T> cells_out;
+#pragma HLS STREAM variable = cells_in depth = 2
+#pragma HLS STREAM variable = cells_out depth = 2
+
+    int ghost_rows = boundary == BOUNDARY_TOROIDAL ? 1 : 0;
+    read_cells<T, max_columns>(stream_in, cells_in, (rows + ghost_rows) * columns);
+    life_chain<K, T, max_columns>::run(cells_in, cells_out, columns, rows, boundary);
+    write_cells<T, max_columns>(cells_out, stream_out, rows * columns);
+}
+
+// Sizes in values of the stage, see life_stage
+static bool valid_grid(int columns, int max_columns, int rows, int boundary)
+{
+    if (columns < 2 || columns > max_columns || rows < 1)
+        return false;
+    return boundary == BOUNDARY_DEAD || boundary == BOUNDARY_TOROIDAL || boundary == BOUNDARY_FROZEN;
+}
+
 extern "C"
 {
+    // One generation, one cell per beat, see life_stage for the stream layout
+    // of each boundary mode. Grids wider than MAX_WIDTH have to be split into
+    // vertical strips with a halo column on either side, see
+    // gameoflife_step_in_strips in gameoflife_host.h. Returns -1 for an
+    // unsupported size or boundary mode.
     int gameoflife_compute(
-        hls::stream<ap_axis<32, 2, 5, 6>> &stream_in,
-        hls::stream<ap_axis<32, 2, 5, 6>> &stream_out,
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
         int grid_width,
-        int grid_height)
+        int grid_height,
+        int boundary)
     {
 #pragma HLS INTERFACE axis port = stream_in
 #pragma HLS INTERFACE axis port = stream_out
 #pragma HLS INTERFACE s_axilite port = grid_width
 #pragma HLS INTERFACE s_axilite port = grid_height
+#pragma HLS INTERFACE s_axilite port = boundary
 #pragma HLS INTERFACE s_axilite port = return
 
-        int mat3[9];
+        if (!valid_grid(grid_width, MAX_WIDTH, grid_height, boundary))
+            return -1;
 
-        // fifo_shiftreg_1<int, 1024 - 1> line_1;
-        // fifo_shiftreg_1<int, 1024 - 1> line_2;
-        // fifo_shiftreg_1<int, 1024 - 1> line_3;
+        life_dataflow<1, cell_type, MAX_WIDTH>(stream_in, stream_out, grid_width, grid_height, boundary);
 
-        // fifo_shiftreg_2<int, 1024> line_1(grid_width - 1);
-        // fifo_shiftreg_2<int, 1024> line_2(grid_width - 1);
-        // fifo_shiftreg_2<int, 1024> line_3(grid_width - 1);
+        return 0;
+    }
 
-        fifo_bram<int, 1024> line_1(grid_width - 1);
-        fifo_bram<int, 1024> line_2(grid_width - 1);
-        fifo_bram<int, 1024> line_3(grid_width - 1);
+    // GENERATIONS generations in one pass over the stream. The toroidal top
+    // ghost row of every stage would be the last row of the stage before,
+    // which only comes out at the very end, so BOUNDARY_TOROIDAL is rejected
+    // with -1 like an unsupported size.
+    int gameoflife_compute_generations(
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
+        int grid_width,
+        int grid_height,
+        int boundary)
+    {
+#pragma HLS INTERFACE axis port = stream_in
+#pragma HLS INTERFACE axis port = stream_out
+#pragma HLS INTERFACE s_axilite port = grid_width
+#pragma HLS INTERFACE s_axilite port = grid_height
+#pragma HLS INTERFACE s_axilite port = boundary
+#pragma HLS INTERFACE s_axilite port = return
 
-    gameoflife_y_loop:
-        for (int y = -1; y <= grid_height + 3; y++)
-        {
-#pragma HLS loop_tripcount min = 1024 max = 1024 avg = 1024
+        if (!valid_grid(grid_width, MAX_WIDTH, grid_height, boundary) || boundary == BOUNDARY_TOROIDAL)
+            return -1;
 
-        gameoflife_x_loop:
-            for (int x = -1; x <= grid_width; x++)
-            {
-#pragma HLS loop_tripcount min = 1024 max = 1024 avg = 1024
-
-                int data = 0;
-
-                if (y >= 0 && x >= 0 && y < grid_height && x < grid_width)
-                {
-                    ap_axis<32, 2, 5, 6> package_in;
-                    stream_in.read(package_in);
-                    data = package_in.data;
-                }
-
-                int last_line_1 = line_1.shift(data);
-                int last_line_2 = line_2.shift(mat3[2]);
-                int last_line_3 = line_3.shift(mat3[5]);
-
-                mat3[2] = mat3[1];
-                mat3[1] = mat3[0];
-                mat3[0] = last_line_1;
-
-                mat3[5] = mat3[4];
-                mat3[4] = mat3[3];
-                mat3[3] = last_line_2;
-
-                mat3[8] = mat3[7];
-                mat3[7] = mat3[6];
-                mat3[6] = last_line_3;
-
-                // Compute the sum of the 8 neighbors
-                int total = 0;
-            compute_sum_loop:
-                for (int i = 0; i < 9; i++)
-                {
-                    if (i == 4)
-                        continue;
-                    total += mat3[i];
-                }
-
-                int old_val = mat3[4];
-                int new_val = old_val;
-                // Apply Conway's Game of Life rules
-                if (old_val == 1)
-                {
-                    if (total < 2 || total > 3)
-                    {
-                        new_val = 0;
-                    }
-                }
-                else
-                {
-                    if (total == 3)
-                    {
-                        new_val = 1;
-                    }
-                }
-
-                if (y >= 4 && x >= 1)
-                {
-                    ap_axis<32, 2, 5, 6> package_out;
-                    package_out.data = new_val;
-                    package_out.keep = -1;
-                    package_out.strb = -1;
-                    if (y == grid_height + 3 && x == grid_width)
-                        package_out.last = 1;
-                    else
-                        package_out.last = 0;
-                    stream_out.write(package_out);
-                }
-            }
-        }
+        life_dataflow<GENERATIONS, cell_type, MAX_WIDTH>(stream_in, stream_out, grid_width, grid_height, boundary);
+
+        return 0;
+    }
+
+    // One generation like gameoflife_compute, with 32 cells per beat, the
+    // first one in bit 0. grid_width has to be a multiple of 32 and at
+    // least 64.
+    int gameoflife_compute_packed(
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
+        int grid_width,
+        int grid_height,
+        int boundary)
+    {
+#pragma HLS INTERFACE axis port = stream_in
+#pragma HLS INTERFACE axis port = stream_out
+#pragma HLS INTERFACE s_axilite port = grid_width
+#pragma HLS INTERFACE s_axilite port = grid_height
+#pragma HLS INTERFACE s_axilite port = boundary
+#pragma HLS INTERFACE s_axilite port = return
+
+        if (grid_width % 32 != 0 || !valid_grid(grid_width / 32, MAX_WIDTH / 32, grid_height, boundary))
+            return -1;
+
+        life_dataflow<1, word_type, MAX_WIDTH / 32>(stream_in, stream_out, grid_width / 32, grid_height, boundary);
 
         return 0;
     }
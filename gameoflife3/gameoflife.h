@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ap_axi_sdata.h"
+#include "ap_int.h"
+#include "hls_stream.h"
+
+// Every life_stage holds four line buffers of up to MAX_WIDTH + 3 cells. At
+// one bit per cell each fits a BRAM18 in its 16K x 1 shape: 4 BRAM18 for
+// gameoflife_compute, 4 * GENERATIONS for gameoflife_compute_generations.
+// The packed kernel's four buffers are MAX_WIDTH / 32 words deep, one BRAM18
+// each.
+#define MAX_WIDTH 8192 // Widest grid the line buffers hold, wider ones go in strips
+#define GENERATIONS 4  // Generations per pass of gameoflife_compute_generations
+#define TRIPCOUNT_ROWS 1024 // Grid height the synthesis report assumes, the height itself is unbounded
+
+// What the cells outside the grid look like
+#define BOUNDARY_DEAD 0     // Always dead
+#define BOUNDARY_TOROIDAL 1 // The opposite edge of the grid, see gameoflife_compute
+#define BOUNDARY_FROZEN 2   // Dead, and the cells on the border keep their value
+
+typedef ap_axis<32, 2, 5, 6> packet;
+
+extern "C"
+{
+    int gameoflife_compute(
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
+        int grid_width,
+        int grid_height,
+        int boundary);
+
+    int gameoflife_compute_generations(
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
+        int grid_width,
+        int grid_height,
+        int boundary);
+
+    int gameoflife_compute_packed(
+        hls::stream<packet> &stream_in,
+        hls::stream<packet> &stream_out,
+        int grid_width,
+        int grid_height,
+        int boundary);
+}
@@ -0,0 +1,107 @@
+#include "gameoflife_host.h"
+
+void to_stream(const bool *data, int width, int height, hls::stream<packet> &stream)
+{
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            packet tmp;
+            tmp.data = data[y * width + x];
+            tmp.keep = -1;
+            if (x == width - 1 && y == height - 1)
+                tmp.last = true;
+            else
+                tmp.last = false;
+            stream.write(tmp);
+        }
+    }
+}
+
+void to_stream_toroidal(const bool *data, int width, int height, hls::stream<packet> &stream)
+{
+    for (int x = 0; x < width; x++)
+    {
+        packet tmp;
+        tmp.data = data[(height - 1) * width + x];
+        tmp.keep = -1;
+        tmp.last = false;
+        stream.write(tmp);
+    }
+    to_stream(data, width, height, stream);
+}
+
+void from_stream(bool *data, int width, int height, hls::stream<packet> &stream)
+{
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            packet tmp;
+            stream.read(tmp);
+            data[y * width + x] = tmp.data;
+        }
+    }
+}
+
+// Strips overlap by a halo column on either side, read from the neighbouring
+// strip, or across the edge for BOUNDARY_TOROIDAL. At the other grid edges
+// the kernel's own boundary handling takes over. The halo columns come back
+// wrong, as their outer neighbours are missing, and are dropped.
+bool gameoflife_step_in_strips(const bool *grid, bool *new_grid, int width, int height, int boundary,
+                               int strip_width)
+{
+    if (strip_width < 3)
+        return false;
+
+    hls::stream<packet> stream_in;
+    hls::stream<packet> stream_out;
+    bool toroidal = boundary == BOUNDARY_TOROIDAL;
+    bool *strip = new bool[strip_width * height];
+    bool ok = true;
+
+    // first is the first grid column of the strip, inner its column count
+    // without the halo
+    int first = 0;
+    while (first < width)
+    {
+        int halo_left = (first > 0 || toroidal) ? 1 : 0;
+        int inner = strip_width - halo_left - 1;
+        if (first + inner >= width)
+            inner = width - first;
+        int halo_right = (first + inner < width || toroidal) ? 1 : 0;
+        int columns = halo_left + inner + halo_right;
+
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < columns; x++)
+            {
+                int grid_x = (first - halo_left + x + width) % width;
+                strip[y * columns + x] = grid[y * width + grid_x];
+            }
+        }
+
+        if (toroidal)
+            to_stream_toroidal(strip, columns, height, stream_in);
+        else
+            to_stream(strip, columns, height, stream_in);
+        if (gameoflife_compute(stream_in, stream_out, columns, height, boundary) != 0)
+        {
+            // A rejected grid leaves its input unread
+            while (!stream_in.empty())
+                stream_in.read();
+            ok = false;
+            break;
+        }
+        from_stream(strip, columns, height, stream_out);
+
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < inner; x++)
+                new_grid[y * width + first + x] = strip[y * columns + halo_left + x];
+
+        first += inner;
+    }
+
+    delete[] strip;
+    return ok;
+}
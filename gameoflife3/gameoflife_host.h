@@ -0,0 +1,22 @@
+#pragma once
+
+// Host side of gameoflife_compute: moving a grid of one bool per cell in and
+// out of the streams, and stepping grids wider than MAX_WIDTH in strips.
+// Build it together with gameoflife.cpp for the C simulation, as
+// gameoflife_tb.cpp does. On the board the notebook steps wide grids with
+// gameoflife_host.py, which splits them the same way.
+
+#include "gameoflife.h"
+
+void to_stream(const bool *data, int width, int height, hls::stream<packet> &stream);
+
+// BOUNDARY_TOROIDAL wants the last row in front of the grid
+void to_stream_toroidal(const bool *data, int width, int height, hls::stream<packet> &stream);
+
+void from_stream(bool *data, int width, int height, hls::stream<packet> &stream);
+
+// One generation of a grid of any width through gameoflife_compute, in
+// vertical strips of up to strip_width columns, 3 to MAX_WIDTH. Every
+// boundary mode works. Returns false if the kernel rejected a strip.
+bool gameoflife_step_in_strips(const bool *grid, bool *new_grid, int width, int height, int boundary,
+                               int strip_width);
@@ -0,0 +1,58 @@
+import numpy as np
+
+# Host side of gameoflife_compute on the board, the Python twin of
+# gameoflife_host.cpp. The notebook drives the kernel through the DMA, this
+# splits grids wider than MAX_WIDTH into strips it can take.
+
+MAX_WIDTH = 8192 # Widest grid the line buffers hold, as in gameoflife.h
+
+# What the cells outside the grid look like, as in gameoflife.h
+BOUNDARY_DEAD = 0
+BOUNDARY_TOROIDAL = 1
+BOUNDARY_FROZEN = 2
+
+def to_words(grid, boundary):
+    # One int32 per cell, row by row. BOUNDARY_TOROIDAL wants the last row in
+    # front of the grid.
+    words = grid.astype(np.int32).ravel()
+    if boundary == BOUNDARY_TOROIDAL:
+        words = np.concatenate((grid[-1].astype(np.int32), words))
+    return words
+
+def step_in_strips(grid, boundary, strip_width, step):
+    # One generation of a height x width grid of any width, in vertical strips
+    # of up to strip_width columns, 3 to MAX_WIDTH. step(words, width, height,
+    # boundary) runs one strip through the kernel and returns its width * height
+    # cells, or None if the kernel rejected it, which this then returns too.
+    #
+    # Strips overlap by a halo column on either side, read from the
+    # neighbouring strip, or across the edge for BOUNDARY_TOROIDAL. At the other
+    # grid edges the kernel's own boundary handling takes over. The halo
+    # columns come back wrong, as their outer neighbours are missing, and are
+    # dropped.
+    if strip_width < 3:
+        return None
+
+    height, width = grid.shape
+    toroidal = boundary == BOUNDARY_TOROIDAL
+    new_grid = np.empty_like(grid)
+
+    # first is the first grid column of the strip, inner its column count
+    # without the halo
+    first = 0
+    while first < width:
+        halo_left = 1 if first > 0 or toroidal else 0
+        inner = min(strip_width - halo_left - 1, width - first)
+        halo_right = 1 if first + inner < width or toroidal else 0
+        columns = halo_left + inner + halo_right
+
+        strip = grid[:, (first - halo_left + np.arange(columns)) % width]
+        cells = step(to_words(strip, boundary), columns, height, boundary)
+        if cells is None:
+            return None
+        cells = np.asarray(cells).reshape(height, columns)
+        new_grid[:, first:first + inner] = cells[:, halo_left:halo_left + inner]
+
+        first += inner
+
+    return new_grid
@@ -1,20 +1,13 @@
+#include <algorithm>
 #include <iostream>
 #include <stdio.h>
-#include "ap_axi_sdata.h"
-#include "hls_stream.h"
+
+#include "gameoflife.h"
+#include "gameoflife_host.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-extern "C"
-{
-    int gameoflife_compute(
-        hls::stream<ap_axis<32, 2, 5, 6>> &stream_in,
-        hls::stream<ap_axis<32, 2, 5, 6>> &stream_out,
-        int grid_width,
-        int grid_height);
-}
-
 ap_uint<16> lfsr_random()
 {
     static ap_uint<16> lfsr = 0xACE1u; // Initial seed value (non-zero)
@@ -46,39 +39,203 @@ static void initialize_grid(bool *grid, unsigned int width, unsigned int height)
     }
 }
 
-void to_stream(const bool *data, int width, int height, hls::stream<ap_axis<32, 2, 5, 6>> &stream)
+// One generation on the host, cells outside the grid as the boundary mode says
+static void reference_step(const bool *grid, bool *new_grid, int width, int height, int boundary)
 {
     for (int y = 0; y < height; y++)
     {
         for (int x = 0; x < width; x++)
         {
-            ap_axis<32, 2, 5, 6> tmp;
-            tmp.data = data[y * width + x];
-            tmp.keep = -1;
-            if (x == width - 1 && y == height - 1)
-                tmp.last = true;
+            int total = 0;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int ny = y + dy, nx = x + dx;
+                    if (boundary == BOUNDARY_TOROIDAL)
+                    {
+                        ny = (ny + height) % height;
+                        nx = (nx + width) % width;
+                    }
+                    if ((dy != 0 || dx != 0) && ny >= 0 && ny < height && nx >= 0 && nx < width)
+                        total += grid[ny * width + nx];
+                }
+            }
+
+            bool old_val = grid[y * width + x];
+            bool border = y == 0 || y == height - 1 || x == 0 || x == width - 1;
+            if (boundary == BOUNDARY_FROZEN && border)
+                new_grid[y * width + x] = old_val;
             else
-                tmp.last = false;
-            stream.write(tmp);
+                new_grid[y * width + x] = old_val ? (total == 2 || total == 3) : (total == 3);
         }
     }
 }
 
-void from_stream(bool *data, int width, int height, hls::stream<ap_axis<32, 2, 5, 6>> &stream)
+// 32 cells per beat for gameoflife_compute_packed, the first one in bit 0
+static void to_stream_packed(const bool *data, int width, int first_row, int rows, hls::stream<packet> &stream)
 {
-    for (int y = 0; y < height; y++)
+    for (int k = first_row * width; k < (first_row + rows) * width; k += 32)
     {
-        for (int x = 0; x < width; x++)
+        ap_uint<32> word = 0;
+        for (int b = 0; b < 32; b++)
+            word[b] = data[k + b];
+        packet tmp;
+        tmp.data = word;
+        tmp.keep = -1;
+        tmp.last = false;
+        stream.write(tmp);
+    }
+}
+
+static void from_stream_packed(bool *data, int width, int height, hls::stream<packet> &stream)
+{
+    for (int k = 0; k < width * height; k += 32)
+    {
+        packet tmp;
+        stream.read(tmp);
+        ap_uint<32> word = tmp.data;
+        for (int b = 0; b < 32; b++)
+            data[k + b] = word[b];
+    }
+}
+
+// One generation of width x height cells through a kernel variant, false if
+// it rejects the grid or leaves words in a stream
+typedef bool (*step_function)(const bool *grid, bool *output, int width, int height, int boundary);
+
+static bool step_compute(const bool *grid, bool *output, int width, int height, int boundary)
+{
+    hls::stream<packet> stream_in;
+    hls::stream<packet> stream_out;
+    if (boundary == BOUNDARY_TOROIDAL)
+        to_stream_toroidal(grid, width, height, stream_in);
+    else
+        to_stream(grid, width, height, stream_in);
+    bool ok = gameoflife_compute(stream_in, stream_out, width, height, boundary) == 0;
+    from_stream(output, width, height, stream_out);
+    return ok && stream_in.empty() && stream_out.empty();
+}
+
+static bool step_packed(const bool *grid, bool *output, int width, int height, int boundary)
+{
+    hls::stream<packet> stream_in;
+    hls::stream<packet> stream_out;
+    if (boundary == BOUNDARY_TOROIDAL)
+        to_stream_packed(grid, width, height - 1, 1, stream_in);
+    to_stream_packed(grid, width, 0, height, stream_in);
+    bool ok = gameoflife_compute_packed(stream_in, stream_out, width, height, boundary) == 0;
+    from_stream_packed(output, width, height, stream_out);
+    return ok && stream_in.empty() && stream_out.empty();
+}
+
+// gameoflife_step_in_strips with strips of up to STRIP_WIDTH columns
+template <int STRIP_WIDTH>
+static bool step_strips(const bool *grid, bool *output, int width, int height, int boundary)
+{
+    return gameoflife_step_in_strips(grid, output, width, height, boundary, STRIP_WIDTH);
+}
+
+// Runs a few generations of every boundary mode through step against reference_step
+static bool check_modes(const char *name, int width, int height, int generations, step_function step)
+{
+    const char *names[] = {"dead", "toroidal", "frozen"};
+    bool *grid = new bool[width * height];
+    bool *expected = new bool[width * height];
+    bool *output = new bool[width * height];
+    bool ok = true;
+
+    for (int boundary = BOUNDARY_DEAD; boundary <= BOUNDARY_FROZEN && ok; boundary++)
+    {
+        initialize_grid(grid, width, height);
+        for (int i = 0; i < generations && ok; i++)
+        {
+            ok &= step(grid, output, width, height, boundary);
+            reference_step(grid, expected, width, height, boundary);
+            for (int k = 0; k < width * height; k++)
+                ok &= output[k] == expected[k];
+            if (!ok)
+                std::cout << width << "x" << height << " " << name << " " << names[boundary] << " differs in generation " << i + 1 << std::endl;
+            std::swap(grid, output);
+        }
+    }
+
+    delete[] grid;
+    delete[] expected;
+    delete[] output;
+    return ok;
+}
+
+// One pass of gameoflife_compute_generations against GENERATIONS reference steps
+static bool check_generations(int width, int height, int boundary)
+{
+    bool *grid = new bool[width * height];
+    bool *expected = new bool[width * height];
+    bool *scratch = new bool[width * height];
+    bool *output = new bool[width * height];
+    hls::stream<packet> stream_in;
+    hls::stream<packet> stream_out;
+    bool ok = true;
+
+    initialize_grid(grid, width, height);
+    for (int pass = 0; pass < 5 && ok; pass++)
+    {
+        to_stream(grid, width, height, stream_in);
+        ok &= gameoflife_compute_generations(stream_in, stream_out, width, height, boundary) == 0;
+        from_stream(output, width, height, stream_out);
+        ok &= stream_in.empty() && stream_out.empty();
+
+        std::copy(grid, grid + width * height, expected);
+        for (int i = 0; i < GENERATIONS; i++)
         {
-            ap_axis<32, 2, 5, 6> tmp;
-            stream.read(tmp);
-            data[y * width + x] = tmp.data;
+            reference_step(expected, scratch, width, height, boundary);
+            std::swap(expected, scratch);
         }
+        for (int k = 0; k < width * height; k++)
+            ok &= output[k] == expected[k];
+        if (!ok)
+            std::cout << width << "x" << height << " pass " << pass + 1 << " of gameoflife_compute_generations differs" << std::endl;
+        std::swap(grid, output);
     }
+
+    delete[] grid;
+    delete[] expected;
+    delete[] scratch;
+    delete[] output;
+    return ok;
 }
 
 int main()
 {
+    if (!check_modes("gameoflife_compute", 37, 23, 20, step_compute) || !check_modes("gameoflife_compute", 2, 5, 20, step_compute) ||
+        !check_modes("gameoflife_compute", 9, 1, 20, step_compute) || !check_modes("gameoflife_compute", 200, 2, 20, step_compute))
+        return 1;
+
+    if (!check_generations(37, 23, BOUNDARY_DEAD) || !check_generations(64, 3, BOUNDARY_FROZEN))
+        return 1;
+
+    if (!check_modes("packed", 96, 40, 20, step_packed) || !check_modes("packed", 64, 1, 20, step_packed) ||
+        !check_modes("packed", MAX_WIDTH, 8, 20, step_packed))
+        return 1;
+
+    if (!check_modes("in strips", 100, 30, 5, step_strips<24>) ||
+        !check_modes("in strips", 2 * MAX_WIDTH + 100, 6, 5, step_strips<MAX_WIDTH>))
+        return 1;
+
+    hls::stream<packet> unused_in;
+    hls::stream<packet> unused_out;
+    if (gameoflife_compute(unused_in, unused_out, MAX_WIDTH + 1, 4, BOUNDARY_DEAD) != -1 ||
+        gameoflife_compute(unused_in, unused_out, 1, 4, BOUNDARY_DEAD) != -1 ||
+        gameoflife_compute(unused_in, unused_out, 16, 16, 3) != -1 ||
+        gameoflife_compute_generations(unused_in, unused_out, 16, 16, BOUNDARY_TOROIDAL) != -1 ||
+        gameoflife_compute_packed(unused_in, unused_out, 48, 16, BOUNDARY_DEAD) != -1 ||
+        gameoflife_compute_packed(unused_in, unused_out, 32, 16, BOUNDARY_DEAD) != -1 ||
+        gameoflife_compute_packed(unused_in, unused_out, MAX_WIDTH + 32, 16, BOUNDARY_DEAD) != -1)
+    {
+        std::cout << "gameoflife_compute accepted an unsupported grid" << std::endl;
+        return 1;
+    }
+
     int width = 1024;
     int height = 1024;
 
@@ -90,13 +247,13 @@ int main()
     bool *grid = grid1;
     bool *back_grid = grid2;
 
-    hls::stream<ap_axis<32, 2, 5, 6>> stream_in;
-    hls::stream<ap_axis<32, 2, 5, 6>> stream_out;
+    hls::stream<packet> stream_in;
+    hls::stream<packet> stream_out;
 
     for (int i = 0; i < 10; i++)
     {
         to_stream(grid, width, height, stream_in);
-        gameoflife_compute(stream_in, stream_out, width, height);
+        gameoflife_compute(stream_in, stream_out, width, height, BOUNDARY_DEAD);
         from_stream(back_grid, width, height, stream_out);
         // std::swap(grid, back_grid);
         bool *temp = grid;